@@ -4,11 +4,18 @@
 #include "FormulaLexer.h"
 #include "FormulaParser.h"
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <charconv>
+#include <climits>
 #include <cmath>
+#include <cstdint>
+#include <iterator>
 #include <memory>
 #include <optional>
 #include <sstream>
+#include <string_view>
 #include <utility>
 
 namespace ASTImpl {
@@ -68,12 +75,19 @@ namespace ASTImpl {
         /* EP_ATOM */ {PR_NONE, PR_NONE, PR_NONE, PR_NONE, PR_NONE, PR_NONE},
     };
 
+    // Nodes live in an Arena and are never destroyed, so they must not own
+    // anything: children are plain pointers into the same arena
     class Expr {
     public:
-        virtual ~Expr() = default;
         virtual void Print(std::ostream& out) const = 0;
         virtual void DoPrintFormula(std::ostream& out, ExprPrecedence precedence) const = 0;
-        virtual double Evaluate(std::unordered_map< std::string, double > args) const = 0; /*добавьте сюда нужные аргументы*/
+        // appends the postfix form of the subtree to the program
+        virtual void Compile(FormulaProgram& program) const = 0;
+
+        // non-null only for a range argument of a function
+        virtual const CellRange* GetRange() const {
+            return nullptr;
+        }
 
         // higher is tighter
         virtual ExprPrecedence GetPrecedence() const = 0;
@@ -93,6 +107,9 @@ namespace ASTImpl {
                 out << ')';
             }
         }
+
+    protected:
+        ~Expr() = default;
     };
 
     namespace {
@@ -106,10 +123,10 @@ namespace ASTImpl {
             };
 
         public:
-            explicit BinaryOpExpr(Type type, std::unique_ptr<Expr> lhs, std::unique_ptr<Expr> rhs)
+            explicit BinaryOpExpr(Type type, const Expr* lhs, const Expr* rhs)
                 : type_(type)
-                , lhs_(std::move(lhs))
-                , rhs_(std::move(rhs)) {
+                , lhs_(lhs)
+                , rhs_(rhs) {
             }
 
             void Print(std::ostream& out) const override {
@@ -143,42 +160,31 @@ namespace ASTImpl {
                 }
             }
 
-            // Реализуйте метод Evaluate() для бинарных операций.
-            // При делении на 0 выбрасывайте ошибку вычисления FormulaError
-            double Evaluate(std::unordered_map< std::string, double > args) const override {  /*добавьте нужные аргументы*/
-                using namespace std::literals;
-
+            void Compile(FormulaProgram& program) const override {
+                lhs_->Compile(program);
+                rhs_->Compile(program);
                 switch (type_) {
                 case Add:
-                    if (!std::isfinite(lhs_.get()->Evaluate(args) + rhs_.get()->Evaluate(args))) {
-                        throw FormulaError(FormulaError::Category::Arithmetic);
-                    }
-                    return lhs_.get()->Evaluate(args) + rhs_.get()->Evaluate(args);
+                    program.PushOperation(FormulaProgram::OpCode::Add);
+                    break;
                 case Subtract:
-                    if (!std::isfinite(lhs_.get()->Evaluate(args) - rhs_.get()->Evaluate(args))) {
-                        throw FormulaError(FormulaError::Category::Arithmetic);
-                    }
-                    return lhs_.get()->Evaluate(args) - rhs_.get()->Evaluate(args);
+                    program.PushOperation(FormulaProgram::OpCode::Subtract);
+                    break;
                 case Multiply:
-                    if (!std::isfinite(lhs_.get()->Evaluate(args) * rhs_.get()->Evaluate(args))) {
-                        throw FormulaError(FormulaError::Category::Arithmetic);
-                    }
-                    return lhs_.get()->Evaluate(args) * rhs_.get()->Evaluate(args);
+                    program.PushOperation(FormulaProgram::OpCode::Multiply);
+                    break;
                 case Divide:
-                    if (!std::isfinite(lhs_.get()->Evaluate(args) / rhs_.get()->Evaluate(args))) {
-                        throw FormulaError(FormulaError::Category::Arithmetic);
-                    }
-                    return lhs_.get()->Evaluate(args) / rhs_.get()->Evaluate(args);
+                    program.PushOperation(FormulaProgram::OpCode::Divide);
+                    break;
                 default:
                     assert(false);
-                    return static_cast<ExprPrecedence>(INT_MAX);
                 }
             }
 
         private:
             Type type_;
-            std::unique_ptr<Expr> lhs_;
-            std::unique_ptr<Expr> rhs_;
+            const Expr* lhs_;
+            const Expr* rhs_;
         };
 
         class UnaryOpExpr final : public Expr {
@@ -189,9 +195,9 @@ namespace ASTImpl {
             };
 
         public:
-            explicit UnaryOpExpr(Type type, std::unique_ptr<Expr> operand)
+            explicit UnaryOpExpr(Type type, const Expr* operand)
                 : type_(type)
-                , operand_(std::move(operand)) {
+                , operand_(operand) {
             }
 
             void Print(std::ostream& out) const override {
@@ -209,36 +215,48 @@ namespace ASTImpl {
                 return EP_UNARY;
             }
 
-            double Evaluate(std::unordered_map< std::string, double > args) const override { /*добавьте нужные аргументы*/
+            void Compile(FormulaProgram& program) const override {
+                operand_->Compile(program);
                 switch (type_) {
                 case UnaryPlus:
-                    return operand_.get()->Evaluate(args);
+                    break;
                 case UnaryMinus:
-                    return -operand_.get()->Evaluate(args);
+                    program.PushOperation(FormulaProgram::OpCode::Negate);
+                    break;
                 default:
                     // have to do this because VC++ has a buggy warning
                     assert(false);
-                    return static_cast<ExprPrecedence>(INT_MAX);
                 }
             }
 
         private:
             Type type_;
-            std::unique_ptr<Expr> operand_;
+            const Expr* operand_;
         };
 
         class CellExpr final : public Expr {
         public:
-            explicit CellExpr(const Position* cell)
-                : cell_(cell) {
+            // the cells of a tree are chained, so that they are collected without a walk
+            CellExpr(Position cell, const CellExpr* previous)
+                : cell_(cell)
+                , previous_(previous) {
+            }
+
+            Position GetCell() const {
+                return cell_;
+            }
+
+            const CellExpr* GetPrevious() const {
+                return previous_;
             }
 
             void Print(std::ostream& out) const override {
-                if (!cell_->IsValid()) {
+                if (!cell_.IsValid()) {
                     out << FormulaError::Category::Ref;
                 }
                 else {
-                    out << cell_->ToString();
+                    char buffer[Position::MAX_STRING_LENGTH];
+                    out.write(buffer, static_cast<std::streamsize>(cell_.ToChars(buffer)));
                 }
             }
 
@@ -250,16 +268,152 @@ namespace ASTImpl {
                 return EP_ATOM;
             }
 
-            double Evaluate(std::unordered_map< std::string, double > args) const override { /*добавьте нужные аргументы*/
-                // реализуйте метод. ------------------------------------------------------------------------------------------------------------------
-                //double result = args(cell_->ToString());
-                return args[cell_->ToString()];
+            void Compile(FormulaProgram& program) const override {
+                program.PushCell(cell_);
+            }
+
+        private:
+            Position cell_;
+            const CellExpr* previous_;
+        };
+
+        // A1:B5 as an argument of a function; ranges are compiled by the call
+        class RangeExpr final : public Expr {
+        public:
+            explicit RangeExpr(CellRange range)
+                : range_(range) {
+            }
+
+            void Print(std::ostream& out) const override {
+                char buffer[CellRange::MAX_STRING_LENGTH];
+                out.write(buffer, static_cast<std::streamsize>(range_.ToChars(buffer)));
+            }
+
+            void DoPrintFormula(std::ostream& out, ExprPrecedence /* precedence */) const override {
+                Print(out);
+            }
+
+            ExprPrecedence GetPrecedence() const override {
+                return EP_ATOM;
+            }
+
+            void Compile(FormulaProgram& /* program */) const override {
+                assert(false);
+            }
+
+            const CellRange* GetRange() const override {
+                return &range_;
             }
 
         private:
-            const Position* cell_;
+            CellRange range_;
         };
 
+        class FunctionExpr final : public Expr {
+        public:
+            using Function = FormulaProgram::Function;
+
+            // arguments form a list in the arena, in the order of the call
+            struct Argument {
+                const Expr* expr;
+                const Argument* next = nullptr;
+            };
+
+            FunctionExpr(Function function, const Argument* args)
+                : function_(function)
+                , args_(args) {
+            }
+
+            static std::optional<Function> FromName(std::string_view name) {
+                if (name == "SUM") {
+                    return Function::Sum;
+                }
+                if (name == "MIN") {
+                    return Function::Min;
+                }
+                if (name == "MAX") {
+                    return Function::Max;
+                }
+                if (name == "AVERAGE") {
+                    return Function::Average;
+                }
+                if (name == "COUNT") {
+                    return Function::Count;
+                }
+                return std::nullopt;
+            }
+
+            void Print(std::ostream& out) const override {
+                out << '(' << GetName();
+                for (const Argument* arg = args_; arg != nullptr; arg = arg->next) {
+                    out << ' ';
+                    arg->expr->Print(out);
+                }
+                out << ')';
+            }
+
+            void DoPrintFormula(std::ostream& out, ExprPrecedence /* precedence */) const override {
+                out << GetName() << '(';
+                for (const Argument* arg = args_; arg != nullptr; arg = arg->next) {
+                    if (arg != args_) {
+                        out << ',';
+                    }
+                    arg->expr->PrintFormula(out, EP_ATOM);
+                }
+                out << ')';
+            }
+
+            ExprPrecedence GetPrecedence() const override {
+                return EP_ATOM;
+            }
+
+            // value arguments go to the stack, ranges are read by the call itself
+            void Compile(FormulaProgram& program) const override {
+                std::vector<CellRange> ranges;
+                std::uint32_t value_count = 0;
+                for (const Argument* arg = args_; arg != nullptr; arg = arg->next) {
+                    if (const CellRange* range = arg->expr->GetRange()) {
+                        ranges.push_back(*range);
+                    }
+                    else {
+                        arg->expr->Compile(program);
+                        ++value_count;
+                    }
+                }
+                program.PushCall(function_, value_count, ranges);
+            }
+
+        private:
+            Function function_;
+            const Argument* args_;
+
+            const char* GetName() const {
+                switch (function_) {
+                case Function::Sum:
+                    return "SUM";
+                case Function::Min:
+                    return "MIN";
+                case Function::Max:
+                    return "MAX";
+                case Function::Average:
+                    return "AVERAGE";
+                default:
+                    assert(function_ == Function::Count);
+                    return "COUNT";
+                }
+            }
+        };
+
+        // both corners must be valid, the range is normalized to top-left:bottom-right
+        CellRange MakeRange(std::string_view first, std::string_view second) {
+            const Position from = Position::FromString(first);
+            const Position to = Position::FromString(second);
+            if (!from.IsValid() || !to.IsValid()) {
+                throw FormulaException("Invalid range: " + std::string(first) + ':' + std::string(second));
+            }
+            return CellRange::FromCorners(from, to);
+        }
+
         class NumberExpr final : public Expr {
         public:
             explicit NumberExpr(double value)
@@ -278,33 +432,64 @@ namespace ASTImpl {
                 return EP_ATOM;
             }
 
-            double Evaluate(std::unordered_map< std::string, double > args) const override { /*добавьте нужные аргументы*/
-                return value_;
+            void Compile(FormulaProgram& program) const override {
+                program.PushNumber(value_);
             }
 
         private:
             double value_;
         };
 
+        // Allocates the nodes of a tree being parsed in its arena
+        class TreeBuilder {
+        public:
+            explicit TreeBuilder(std::size_t first_block_size = Arena::MIN_BLOCK_SIZE)
+                : arena_(first_block_size) {
+            }
+
+            template <typename T, typename... Args>
+            T* Make(Args&&... args) {
+                node_count_ += std::is_base_of_v<Expr, T>;
+                return arena_.Make<T>(std::forward<Args>(args)...);
+            }
+
+            const Expr* MakeCell(Position cell) {
+                last_cell_ = Make<CellExpr>(cell, last_cell_);
+                ++cell_count_;
+                return last_cell_;
+            }
+
+            FormulaAST Build(const Expr* root) {
+                auto* cells = static_cast<Position*>(arena_.Allocate(cell_count_ * sizeof(Position), alignof(Position)));
+                std::size_t i = cell_count_;
+                for (const CellExpr* cell = last_cell_; cell != nullptr; cell = cell->GetPrevious()) {
+                    cells[--i] = cell->GetCell();
+                }
+                return FormulaAST(std::move(arena_), root, cells, cell_count_, node_count_);
+            }
+
+        private:
+            Arena arena_;
+            const CellExpr* last_cell_ = nullptr;
+            std::size_t cell_count_ = 0;
+            std::size_t node_count_ = 0;
+        };
+
         class ParseASTListener final : public FormulaBaseListener {
         public:
-            std::unique_ptr<Expr> MoveRoot() {
+            FormulaAST Build() {
                 assert(args_.size() == 1);
-                auto root = std::move(args_.front());
+                const Expr* root = args_.front();
                 args_.clear();
 
-                return root;
-            }
-
-            std::forward_list<Position> MoveCells() {
-                return std::move(cells_);
+                return builder_.Build(root);
             }
 
         public:
             void exitUnaryOp(FormulaParser::UnaryOpContext* ctx) override {
                 assert(args_.size() >= 1);
 
-                auto operand = std::move(args_.back());
+                const Expr* operand = args_.back();
 
                 UnaryOpExpr::Type type;
                 if (ctx->SUB()) {
@@ -315,8 +500,7 @@ namespace ASTImpl {
                     type = UnaryOpExpr::UnaryPlus;
                 }
 
-                auto node = std::make_unique<UnaryOpExpr>(type, std::move(operand));
-                args_.back() = std::move(node);
+                args_.back() = builder_.Make<UnaryOpExpr>(type, operand);
             }
 
             void exitLiteral(FormulaParser::LiteralContext* ctx) override {
@@ -328,8 +512,7 @@ namespace ASTImpl {
                     throw ParsingError("Invalid number: " + valueStr);
                 }
 
-                auto node = std::make_unique<NumberExpr>(value);
-                args_.push_back(std::move(node));
+                args_.push_back(builder_.Make<NumberExpr>(value));
             }
 
             void exitCell(FormulaParser::CellContext* ctx) override {
@@ -339,18 +522,36 @@ namespace ASTImpl {
                     throw FormulaException("Invalid position: " + value_str);
                 }
 
-                cells_.push_front(value);
-                auto node = std::make_unique<CellExpr>(&cells_.front());
-                args_.push_back(std::move(node));
+                args_.push_back(builder_.MakeCell(value));
+            }
+
+            void exitRange(FormulaParser::RangeContext* ctx) override {
+                auto range = MakeRange(ctx->CELL(0)->getSymbol()->getText(), ctx->CELL(1)->getSymbol()->getText());
+                args_.push_back(builder_.Make<RangeExpr>(range));
+            }
+
+            void exitFunction(FormulaParser::FunctionContext* ctx) override {
+                const std::size_t count = ctx->argument().size();
+                assert(args_.size() >= count);
+
+                const FunctionExpr::Argument* args = nullptr;
+                for (std::size_t i = 0; i < count; ++i) {
+                    args = builder_.Make<FunctionExpr::Argument>(FunctionExpr::Argument{ args_.back(), args });
+                    args_.pop_back();
+                }
+
+                const auto function = FunctionExpr::FromName(ctx->FUNCTION()->getSymbol()->getText());
+                assert(function.has_value());
+                args_.push_back(builder_.Make<FunctionExpr>(*function, args));
             }
 
             void exitBinaryOp(FormulaParser::BinaryOpContext* ctx) override {
                 assert(args_.size() >= 2);
 
-                auto rhs = std::move(args_.back());
+                const Expr* rhs = args_.back();
                 args_.pop_back();
 
-                auto lhs = std::move(args_.back());
+                const Expr* lhs = args_.back();
 
                 BinaryOpExpr::Type type;
                 if (ctx->ADD()) {
@@ -367,8 +568,7 @@ namespace ASTImpl {
                     type = BinaryOpExpr::Divide;
                 }
 
-                auto node = std::make_unique<BinaryOpExpr>(type, std::move(lhs), std::move(rhs));
-                args_.back() = std::move(node);
+                args_.back() = builder_.Make<BinaryOpExpr>(type, lhs, rhs);
             }
 
             void visitErrorNode(antlr4::tree::ErrorNode* node) override {
@@ -376,8 +576,8 @@ namespace ASTImpl {
             }
 
         private:
-            std::vector<std::unique_ptr<Expr>> args_;
-            std::forward_list<Position> cells_;
+            TreeBuilder builder_;
+            std::vector<const Expr*> args_;
         };
 
         class BailErrorListener : public antlr4::BaseErrorListener {
@@ -390,41 +590,396 @@ namespace ASTImpl {
             }
         };
 
+        // Hand-written equivalent of the Formula.g4 grammar: the lexer works on
+        // the input string in place and the Pratt parser builds the AST directly,
+        // without a token stream or a parse tree. Operator precedence follows the
+        // ANTLR rewrite of the left-recursive rule: unary operators bind tighter
+        // than '*' and '/', which bind tighter than '+' and '-'; binary operators
+        // are left-associative.
+        class PrattParser {
+        public:
+            explicit PrattParser(std::string_view text)
+                : text_(text)
+                , builder_(GetFirstBlockSize(text.size())) {
+                Advance();
+            }
+
+            FormulaAST Parse() {
+                const Expr* root = ParseExpr(BP_NONE);
+                if (token_.type != TokenType::End) {
+                    Fail();
+                }
+                return builder_.Build(root);
+            }
+
+        private:
+            enum class TokenType {
+                End,
+                Number,
+                Cell,
+                Function,
+                Add,
+                Sub,
+                Mul,
+                Div,
+                LeftParen,
+                RightParen,
+                Colon,
+                Comma,
+            };
+
+            struct Token {
+                TokenType type = TokenType::End;
+                std::string_view text;
+            };
+
+            // binding powers of the infix operators
+            enum BindingPower {
+                BP_NONE,
+                BP_ADDITIVE,
+                BP_MULTIPLICATIVE,
+            };
+
+            std::string_view text_;
+            std::size_t pos_ = 0;
+            Token token_;
+            TreeBuilder builder_;
+
+            // Every node takes at least one character of the text and at most
+            // 32 bytes, so the tree of a formula up to 128 characters fits in
+            // the first block; longer formulas start with 4 KiB
+            static std::size_t GetFirstBlockSize(std::size_t text_size) {
+                return std::min<std::size_t>(Arena::MIN_BLOCK_SIZE + 32 * text_size, 4096);
+            }
+
+            [[noreturn]] void Fail() const {
+                throw ParsingError("Error when parsing: " + std::string(token_.text));
+            }
+
+            static bool IsDigit(char c) {
+                return c >= '0' && c <= '9';
+            }
+
+            std::size_t SkipDigits(std::size_t pos) const {
+                while (pos < text_.size() && IsDigit(text_[pos])) {
+                    ++pos;
+                }
+                return pos;
+            }
+
+            void Advance() {
+                while (pos_ < text_.size()
+                       && (text_[pos_] == ' ' || text_[pos_] == '\t' || text_[pos_] == '\n' || text_[pos_] == '\r')) {
+                    ++pos_;
+                }
+                if (pos_ == text_.size()) {
+                    token_ = { TokenType::End, "<EOF>" };
+                    return;
+                }
+
+                const std::size_t begin = pos_;
+                TokenType type;
+                switch (text_[pos_]) {
+                case '+':
+                    type = TokenType::Add;
+                    ++pos_;
+                    break;
+                case '-':
+                    type = TokenType::Sub;
+                    ++pos_;
+                    break;
+                case '*':
+                    type = TokenType::Mul;
+                    ++pos_;
+                    break;
+                case '/':
+                    type = TokenType::Div;
+                    ++pos_;
+                    break;
+                case '(':
+                    type = TokenType::LeftParen;
+                    ++pos_;
+                    break;
+                case ')':
+                    type = TokenType::RightParen;
+                    ++pos_;
+                    break;
+                case ':':
+                    type = TokenType::Colon;
+                    ++pos_;
+                    break;
+                case ',':
+                    type = TokenType::Comma;
+                    ++pos_;
+                    break;
+                default:
+                    type = LexOperand();
+                }
+                token_ = { type, text_.substr(begin, pos_ - begin) };
+            }
+
+            // CELL: [A-Z]+[0-9]+
+            // FUNCTION: 'SUM' | 'MIN' | 'MAX' | 'AVERAGE' | 'COUNT'
+            // NUMBER: UINT EXPONENT? | UINT? '.' UINT EXPONENT?
+            TokenType LexOperand() {
+                const std::size_t begin = pos_;
+                if (text_[pos_] >= 'A' && text_[pos_] <= 'Z') {
+                    while (pos_ < text_.size() && text_[pos_] >= 'A' && text_[pos_] <= 'Z') {
+                        ++pos_;
+                    }
+                    const std::size_t digits_end = SkipDigits(pos_);
+                    if (digits_end > pos_) {
+                        pos_ = digits_end;
+                        return TokenType::Cell;
+                    }
+                    // letters glued to a function name can't form any valid token sequence
+                    if (!FunctionExpr::FromName(text_.substr(begin, pos_ - begin))) {
+                        FailLexing(begin);
+                    }
+                    return TokenType::Function;
+                }
+
+                std::size_t end = SkipDigits(pos_);
+                if (end < text_.size() && text_[end] == '.') {
+                    const std::size_t fraction_end = SkipDigits(end + 1);
+                    if (fraction_end > end + 1) {
+                        end = fraction_end;
+                    }
+                }
+                if (end == begin) {
+                    FailLexing(begin);
+                }
+                if (end < text_.size() && (text_[end] == 'e' || text_[end] == 'E')) {
+                    std::size_t exponent = end + 1;
+                    if (exponent < text_.size() && (text_[exponent] == '+' || text_[exponent] == '-')) {
+                        ++exponent;
+                    }
+                    const std::size_t exponent_end = SkipDigits(exponent);
+                    if (exponent_end > exponent) {
+                        end = exponent_end;
+                    }
+                }
+                pos_ = end;
+                return TokenType::Number;
+            }
+
+            // the first character of the next token or '\0' at the end
+            char PeekChar() const {
+                std::size_t pos = pos_;
+                while (pos < text_.size() && (text_[pos] == ' ' || text_[pos] == '\t' || text_[pos] == '\n' || text_[pos] == '\r')) {
+                    ++pos;
+                }
+                return pos < text_.size() ? text_[pos] : '\0';
+            }
+
+            [[noreturn]] void FailLexing(std::size_t pos) const {
+                throw ParsingError("Error when lexing: token recognition error at: '"
+                                   + std::string(text_.substr(pos, 1)) + "'");
+            }
+
+            static BindingPower GetBindingPower(TokenType type) {
+                switch (type) {
+                case TokenType::Add:
+                case TokenType::Sub:
+                    return BP_ADDITIVE;
+                case TokenType::Mul:
+                case TokenType::Div:
+                    return BP_MULTIPLICATIVE;
+                default:
+                    return BP_NONE;
+                }
+            }
+
+            const Expr* ParseExpr(BindingPower min_power) {
+                const Expr* lhs = ParsePrefix();
+                BindingPower power = GetBindingPower(token_.type);
+                while (power > min_power) {
+                    BinaryOpExpr::Type type;
+                    switch (token_.type) {
+                    case TokenType::Add:
+                        type = BinaryOpExpr::Add;
+                        break;
+                    case TokenType::Sub:
+                        type = BinaryOpExpr::Subtract;
+                        break;
+                    case TokenType::Mul:
+                        type = BinaryOpExpr::Multiply;
+                        break;
+                    default:
+                        assert(token_.type == TokenType::Div);
+                        type = BinaryOpExpr::Divide;
+                    }
+                    Advance();
+                    const Expr* rhs = ParseExpr(power);
+                    lhs = builder_.Make<BinaryOpExpr>(type, lhs, rhs);
+                    power = GetBindingPower(token_.type);
+                }
+                return lhs;
+            }
+
+            const Expr* ParsePrefix() {
+                switch (token_.type) {
+                case TokenType::Add:
+                case TokenType::Sub: {
+                    const auto type = token_.type == TokenType::Sub ? UnaryOpExpr::UnaryMinus : UnaryOpExpr::UnaryPlus;
+                    Advance();
+                    return builder_.Make<UnaryOpExpr>(type, ParsePrefix());
+                }
+                case TokenType::LeftParen: {
+                    Advance();
+                    const Expr* expr = ParseExpr(BP_NONE);
+                    if (token_.type != TokenType::RightParen) {
+                        Fail();
+                    }
+                    Advance();
+                    return expr;
+                }
+                case TokenType::Number: {
+                    const Expr* node = builder_.Make<NumberExpr>(ParseNumber(token_.text));
+                    Advance();
+                    return node;
+                }
+                case TokenType::Cell:
+                    return ParseCell();
+                case TokenType::Function:
+                    return ParseCall();
+                default:
+                    Fail();
+                }
+            }
+
+            const Expr* ParseCell() {
+                const Position value = Position::FromString(token_.text);
+                if (!value.IsValid()) {
+                    throw FormulaException("Invalid position: " + std::string(token_.text));
+                }
+                Advance();
+                return builder_.MakeCell(value);
+            }
+
+            // FUNCTION '(' argument (',' argument)* ')'
+            const Expr* ParseCall() {
+                const auto function = FunctionExpr::FromName(token_.text);
+                Advance();
+                if (token_.type != TokenType::LeftParen) {
+                    Fail();
+                }
+                const FunctionExpr::Argument* args = nullptr;
+                FunctionExpr::Argument* last = nullptr;
+                do {
+                    Advance();
+                    auto* arg = builder_.Make<FunctionExpr::Argument>(FunctionExpr::Argument{ ParseArgument() });
+                    if (last == nullptr) {
+                        args = arg;
+                    }
+                    else {
+                        last->next = arg;
+                    }
+                    last = arg;
+                } while (token_.type == TokenType::Comma);
+                if (token_.type != TokenType::RightParen) {
+                    Fail();
+                }
+                Advance();
+                return builder_.Make<FunctionExpr>(*function, args);
+            }
+
+            // CELL ':' CELL | expr
+            const Expr* ParseArgument() {
+                if (token_.type != TokenType::Cell || PeekChar() != ':') {
+                    return ParseExpr(BP_NONE);
+                }
+                const std::string_view first = token_.text;
+                Advance();
+                Advance();
+                if (token_.type != TokenType::Cell) {
+                    Fail();
+                }
+                const Expr* range = builder_.Make<RangeExpr>(MakeRange(first, token_.text));
+                Advance();
+                return range;
+            }
+
+            // from_chars does not depend on the locale; the number must take
+            // the whole token, and out-of-range values are rejected like
+            // overflow in the ANTLR listener
+            static double ParseNumber(std::string_view token) {
+                double value = 0;
+                const char* end = token.data() + token.size();
+                const auto [ptr, ec] = std::from_chars(token.data(), end, value);
+                if (ec != std::errc() || ptr != end) {
+                    throw ParsingError("Invalid number: " + std::string(token));
+                }
+                return value;
+            }
+        };
+
     }  // namespace
 }  // namespace ASTImpl
 
-FormulaAST ParseFormulaAST(std::istream& in) {
-    using namespace antlr4;
+namespace {
+#ifdef SPREADSHEET_FORMULA_PARSER_ANTLR
+    std::atomic<FormulaParserKind> formula_parser{ FormulaParserKind::Antlr };
+#else
+    std::atomic<FormulaParserKind> formula_parser{ FormulaParserKind::Pratt };
+#endif
+
+    FormulaAST ParseFormulaASTWithAntlr(std::istream& in) {
+        using namespace antlr4;
 
-    ANTLRInputStream input(in);
+        ANTLRInputStream input(in);
 
-    FormulaLexer lexer(&input);
-    ASTImpl::BailErrorListener error_listener;
-    lexer.removeErrorListeners();
-    lexer.addErrorListener(&error_listener);
+        FormulaLexer lexer(&input);
+        ASTImpl::BailErrorListener error_listener;
+        lexer.removeErrorListeners();
+        lexer.addErrorListener(&error_listener);
 
-    CommonTokenStream tokens(&lexer);
+        CommonTokenStream tokens(&lexer);
 
-    FormulaParser parser(&tokens);
-    auto error_handler = std::make_shared<BailErrorStrategy>();
-    parser.setErrorHandler(error_handler);
-    parser.removeErrorListeners();
+        FormulaParser parser(&tokens);
+        auto error_handler = std::make_shared<BailErrorStrategy>();
+        parser.setErrorHandler(error_handler);
+        parser.removeErrorListeners();
 
-    tree::ParseTree* tree = parser.main();
-    ASTImpl::ParseASTListener listener;
-    tree::ParseTreeWalker::DEFAULT.walk(&listener, tree);
+        tree::ParseTree* tree = parser.main();
+        ASTImpl::ParseASTListener listener;
+        tree::ParseTreeWalker::DEFAULT.walk(&listener, tree);
 
-    return FormulaAST(listener.MoveRoot(), listener.MoveCells());
+        return listener.Build();
+    }
+}  // namespace
+
+void SetFormulaParser(FormulaParserKind kind) {
+    formula_parser.store(kind, std::memory_order_relaxed);
+}
+
+FormulaParserKind GetFormulaParser() {
+    return formula_parser.load(std::memory_order_relaxed);
+}
+
+FormulaAST ParseFormulaAST(std::istream& in) {
+    if (GetFormulaParser() == FormulaParserKind::Antlr) {
+        return ParseFormulaASTWithAntlr(in);
+    }
+    const std::string in_str{ std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>() };
+    return ASTImpl::PrattParser(in_str).Parse();
 }
 
 FormulaAST ParseFormulaAST(const std::string& in_str) {
-    std::istringstream in(in_str);
-    return ParseFormulaAST(in);
+    return ParseFormulaAST(in_str, GetFormulaParser());
+}
+
+FormulaAST ParseFormulaAST(const std::string& in_str, FormulaParserKind kind) {
+    if (kind == FormulaParserKind::Antlr) {
+        std::istringstream in(in_str);
+        return ParseFormulaASTWithAntlr(in);
+    }
+    return ASTImpl::PrattParser(in_str).Parse();
 }
 
 void FormulaAST::PrintCells(std::ostream& out) const {
-    for (auto cell : cells_) {
-        out << cell.ToString() << ' ';
+    for (std::size_t i = 0; i < cell_count_; ++i) {
+        out << cells_[i].ToString() << ' ';
     }
 }
 
@@ -436,14 +991,81 @@ void FormulaAST::PrintFormula(std::ostream& out) const {
     root_expr_->PrintFormula(out, ASTImpl::EP_ATOM);
 }
 
-double FormulaAST::Execute(std::unordered_map< std::string, double > args) const { /*добавьте нужные аргументы*/
-    return root_expr_->Evaluate(/*добавьте нужные аргументы*/ args);
+FormulaProgram FormulaAST::Compile() const {
+    std::vector<Position> cells{ cells_, cells_ + cell_count_ };
+    cells.erase(std::unique(cells.begin(), cells.end()), cells.end());
+    FormulaProgram program(std::move(cells));
+    // every node emits at most one instruction
+    program.ReserveCode(node_count_);
+    root_expr_->Compile(program);
+    return program;
 }
 
-FormulaAST::FormulaAST(std::unique_ptr<ASTImpl::Expr> root_expr, std::forward_list<Position> cells)
-    : root_expr_(std::move(root_expr))
-    , cells_(std::move(cells)) {
-    cells_.sort();  // to avoid sorting in GetReferencedCells
+FormulaAST::FormulaAST(ASTImpl::Arena arena, const ASTImpl::Expr* root_expr, Position* cells, std::size_t cell_count,
+                       std::size_t node_count)
+    : arena_(std::move(arena))
+    , root_expr_(root_expr)
+    , cells_(cells)
+    , cell_count_(cell_count)
+    , node_count_(node_count) {
+    std::sort(cells, cells + cell_count);  // to avoid sorting in GetReferencedCells
 }
 
 FormulaAST::~FormulaAST() = default;
+
+namespace ASTImpl {
+    Arena::Arena(std::size_t first_block_size)
+        : next_block_size_(std::max(first_block_size, MIN_BLOCK_SIZE)) {
+    }
+
+    Arena::Arena(Arena&& other) noexcept
+        : block_(std::exchange(other.block_, nullptr))
+        , current_(std::exchange(other.current_, nullptr))
+        , end_(std::exchange(other.end_, nullptr))
+        , next_block_size_(other.next_block_size_) {
+    }
+
+    Arena& Arena::operator=(Arena&& other) noexcept {
+        if (this != &other) {
+            Release();
+            block_ = std::exchange(other.block_, nullptr);
+            current_ = std::exchange(other.current_, nullptr);
+            end_ = std::exchange(other.end_, nullptr);
+            next_block_size_ = other.next_block_size_;
+        }
+        return *this;
+    }
+
+    Arena::~Arena() {
+        Release();
+    }
+
+    void* Arena::Allocate(std::size_t size, std::size_t alignment) {
+        auto align = [alignment](char* ptr) {
+            const auto address = reinterpret_cast<std::uintptr_t>(ptr);
+            return ptr + (alignment - address % alignment) % alignment;
+        };
+        char* result = align(current_);
+        if (current_ == nullptr || size > static_cast<std::size_t>(end_ - result)) {
+            const std::size_t block_size = std::max(next_block_size_, sizeof(char*) + size + alignment);
+            char* block = static_cast<char*>(::operator new(block_size));
+            *reinterpret_cast<char**>(block) = block_;
+            block_ = block;
+            end_ = block + block_size;
+            next_block_size_ = 2 * block_size;
+            result = align(block + sizeof(char*));
+        }
+        current_ = result + size;
+        return result;
+    }
+
+    void Arena::Release() noexcept {
+        while (block_ != nullptr) {
+            char* previous = *reinterpret_cast<char**>(block_);
+            ::operator delete(block_);
+            block_ = previous;
+        }
+        current_ = nullptr;
+        end_ = nullptr;
+    }
+}  // namespace ASTImpl
@@ -1,16 +1,49 @@
 #pragma once
 
-#include "FormulaLexer.h"
+#include "FormulaProgram.h"
 #include "common.h"
+#include "formula.h"
 
-#include <forward_list>
+#include <cstddef>
 #include <functional>
+#include <new>
 #include <stdexcept>
-#include <unordered_map>
+#include <type_traits>
+#include <utility>
 
 namespace ASTImpl {
 class Expr;
-}
+
+// Bump allocator owning every node of one tree. Nodes hold no resources and
+// are never destroyed one by one: the tree is released together with the
+// blocks, which for a typical formula is a single one.
+class Arena {
+public:
+    static constexpr std::size_t MIN_BLOCK_SIZE = 256;
+
+    explicit Arena(std::size_t first_block_size = MIN_BLOCK_SIZE);
+    Arena(Arena&& other) noexcept;
+    Arena& operator=(Arena&& other) noexcept;
+    ~Arena();
+
+    void* Allocate(std::size_t size, std::size_t alignment);
+
+    template <typename T, typename... Args>
+    T* Make(Args&&... args) {
+        static_assert(std::is_trivially_destructible_v<T>, "arena objects are never destroyed");
+        return new (Allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    }
+
+private:
+    // each block starts with a pointer to the previous one
+    char* block_ = nullptr;
+    char* current_ = nullptr;
+    char* end_ = nullptr;
+    std::size_t next_block_size_;
+
+    void Release() noexcept;
+};
+}  // namespace ASTImpl
 
 class ParsingError : public std::runtime_error {
     using std::runtime_error::runtime_error;
@@ -18,33 +51,34 @@ class ParsingError : public std::runtime_error {
 
 class FormulaAST {
 public:
-    explicit FormulaAST(std::unique_ptr<ASTImpl::Expr> root_expr,
-                        std::forward_list<Position> cells);
+    // the root and the cells live in the arena
+    FormulaAST(ASTImpl::Arena arena, const ASTImpl::Expr* root_expr, Position* cells, std::size_t cell_count,
+               std::size_t node_count);
     FormulaAST(FormulaAST&&) = default;
     FormulaAST& operator=(FormulaAST&&) = default;
     ~FormulaAST();
 
-    double Execute(std::unordered_map< std::string, double > args) const; 
+    // lowers the tree into a flat program; cells are resolved to slots
+    // in sorted order with duplicates removed
+    FormulaProgram Compile() const;
     void PrintCells(std::ostream& out) const;
     void Print(std::ostream& out) const;
     void PrintFormula(std::ostream& out) const;
 
-    std::forward_list<Position>& GetCells() {
-        return cells_;
-    }
-
-    const std::forward_list<Position>& GetCells() const {
-        return cells_;
-    }
-
 private:
-    std::unique_ptr<ASTImpl::Expr> root_expr_;
+    ASTImpl::Arena arena_;
+    const ASTImpl::Expr* root_expr_;
 
     // physically stores cells so that they can be
     // efficiently traversed without going through
     // the whole AST
-    std::forward_list<Position> cells_;
+    const Position* cells_;
+    std::size_t cell_count_;
+    // bounds the size of the compiled program
+    std::size_t node_count_;
 };
 
+// parse with the parser selected by SetFormulaParser()
 FormulaAST ParseFormulaAST(std::istream& in);
 FormulaAST ParseFormulaAST(const std::string& in_str);
+FormulaAST ParseFormulaAST(const std::string& in_str, FormulaParserKind kind);
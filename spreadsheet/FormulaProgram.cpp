@@ -0,0 +1,110 @@
+#include "FormulaProgram.h"
+
+#include <algorithm>
+#include <cassert>
+
+namespace {
+// independent accumulators break the dependency chain of the reduction
+constexpr std::size_t LANES = 4;
+
+double Sum(const double* values, std::size_t count) {
+    const std::size_t body = count - count % LANES;
+    double sum[LANES] = {};
+    for (std::size_t i = 0; i < body; i += LANES) {
+        for (std::size_t lane = 0; lane < LANES; ++lane) {
+            sum[lane] += values[i + lane];
+        }
+    }
+    double total = (sum[0] + sum[1]) + (sum[2] + sum[3]);
+    for (std::size_t i = body; i < count; ++i) {
+        total += values[i];
+    }
+    return total;
+}
+
+// MIN and MAX of no values are 0
+template <typename Pick>
+double Extremum(const double* values, std::size_t count, Pick pick) {
+    if (count == 0) {
+        return 0.0;
+    }
+    const std::size_t body = count - count % LANES;
+    double best[LANES] = {values[0], values[0], values[0], values[0]};
+    for (std::size_t i = 0; i < body; i += LANES) {
+        for (std::size_t lane = 0; lane < LANES; ++lane) {
+            best[lane] = pick(values[i + lane], best[lane]);
+        }
+    }
+    double result = pick(pick(best[0], best[1]), pick(best[2], best[3]));
+    for (std::size_t i = body; i < count; ++i) {
+        result = pick(values[i], result);
+    }
+    return result;
+}
+}  // namespace
+
+FormulaProgram::FormulaProgram(std::vector<Position> cells)
+    : cells_(std::move(cells)) {
+}
+
+void FormulaProgram::ReserveCode(std::size_t size) {
+    code_.reserve(size);
+}
+
+void FormulaProgram::PushNumber(double value) {
+    code_.push_back({OpCode::PushNumber, static_cast<std::uint32_t>(constants_.size())});
+    constants_.push_back(value);
+    max_depth_ = std::max(max_depth_, ++depth_);
+}
+
+void FormulaProgram::PushCell(Position pos) {
+    auto it = std::lower_bound(cells_.begin(), cells_.end(), pos);
+    assert(it != cells_.end() && *it == pos);
+    code_.push_back({OpCode::PushCell, static_cast<std::uint32_t>(it - cells_.begin())});
+    max_depth_ = std::max(max_depth_, ++depth_);
+}
+
+void FormulaProgram::PushOperation(OpCode op) {
+    assert(op != OpCode::PushNumber && op != OpCode::PushCell && op != OpCode::Call);
+    code_.push_back({op});
+    if (op != OpCode::Negate) {
+        assert(depth_ >= 2);
+        --depth_;
+    }
+}
+
+void FormulaProgram::PushCall(Function function, std::uint32_t value_count, const std::vector<CellRange>& ranges) {
+    assert(depth_ >= value_count);
+    code_.push_back({OpCode::Call, static_cast<std::uint32_t>(calls_.size())});
+    calls_.push_back({function, value_count, static_cast<std::uint32_t>(ranges_.size()),
+                      static_cast<std::uint32_t>(ranges.size())});
+    ranges_.insert(ranges_.end(), ranges.begin(), ranges.end());
+    depth_ -= value_count;
+    max_depth_ = std::max(max_depth_, ++depth_);
+}
+
+double FormulaProgram::Aggregate(Function function, const double* values, std::size_t count) {
+    switch (function) {
+    case Function::Sum:
+        return Sum(values, count);
+    case Function::Average:
+        return Sum(values, count) / static_cast<double>(count);
+    case Function::Min:
+        return Extremum(values, count, [](double lhs, double rhs) {
+            return lhs < rhs ? lhs : rhs;
+        });
+    case Function::Max:
+        return Extremum(values, count, [](double lhs, double rhs) {
+            return lhs > rhs ? lhs : rhs;
+        });
+    case Function::Count:
+        return static_cast<double>(count);
+    }
+    assert(false);
+    return 0.0;
+}
+
+std::vector<double>& FormulaProgram::GetCallBuffer() {
+    thread_local std::vector<double> buffer;
+    return buffer;
+}
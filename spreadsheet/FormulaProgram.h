@@ -0,0 +1,198 @@
+#pragma once
+
+#include "common.h"
+
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <optional>
+#include <variant>
+#include <vector>
+
+// Compiled form of a formula: a flat postfix (RPN) instruction array executed
+// by a small stack machine. Cell operands are resolved to integer slots, slot i
+// being the i-th cell of GetCells() (sorted, without duplicates). Ranges are
+// not expanded: an aggregate call refers to its ranges in GetRanges().
+class FormulaProgram {
+public:
+    using Result = std::variant<double, FormulaError>;
+
+    enum class Function : std::uint8_t {
+        Sum,
+        Min,
+        Max,
+        Average,
+        Count,
+    };
+
+    enum class OpCode : std::uint8_t {
+        PushNumber,  // operand is an index in the constant pool
+        PushCell,    // operand is a cell slot
+        Add,
+        Subtract,
+        Multiply,
+        Divide,
+        Negate,
+        Call,        // operand is an index in the call table
+    };
+
+    struct Instruction {
+        OpCode op;
+        std::uint32_t operand = 0;
+    };
+
+    // An aggregate over the top value_count stack values and the ranges
+    // [range_begin, range_begin + range_count) of GetRanges()
+    struct Call {
+        Function function;
+        std::uint32_t value_count;
+        std::uint32_t range_begin;
+        std::uint32_t range_count;
+    };
+
+    FormulaProgram() = default;
+    explicit FormulaProgram(std::vector<Position> cells);
+
+    void ReserveCode(std::size_t size);
+    void PushNumber(double value);
+    void PushCell(Position pos);
+    void PushOperation(OpCode op);
+    // the value arguments must already be pushed
+    void PushCall(Function function, std::uint32_t value_count, const std::vector<CellRange>& ranges);
+
+    const std::vector<Position>& GetCells() const {
+        return cells_;
+    }
+
+    // in the order of the calls, may contain duplicates
+    const std::vector<CellRange>& GetRanges() const {
+        return ranges_;
+    }
+
+    const std::vector<Instruction>& GetCode() const {
+        return code_;
+    }
+
+    const std::vector<double>& GetConstants() const {
+        return constants_;
+    }
+
+    const std::vector<Call>& GetCalls() const {
+        return calls_;
+    }
+
+    // Runs the program. read_cell(slot) returns the numeric value of the cell
+    // in the slot or std::nullopt if the cell can't be treated as a number.
+    // read_range(index, values) appends the numeric values of the index-th range
+    // of GetRanges() to values, skipping empty cells and non-numeric text, and
+    // returns false if a cell of the range holds an error.
+    // As before, #VALUE! of any operand wins over #ARITHM!.
+    template <typename CellReader, typename RangeReader>
+    Result Execute(CellReader&& read_cell, RangeReader&& read_range) const;
+
+    // Reduces contiguous values; the loops keep several independent
+    // accumulators so that the compiler can vectorize them
+    static double Aggregate(Function function, const double* values, std::size_t count);
+
+private:
+    static constexpr std::size_t INLINE_STACK_SIZE = 64;
+
+    std::vector<Instruction> code_;
+    std::vector<double> constants_;
+    std::vector<Position> cells_;
+    std::vector<Call> calls_;
+    std::vector<CellRange> ranges_;
+    std::uint32_t depth_ = 0;
+    std::uint32_t max_depth_ = 0;
+
+    // arguments of a call gathered into one contiguous block
+    static std::vector<double>& GetCallBuffer();
+};
+
+template <typename CellReader, typename RangeReader>
+FormulaProgram::Result FormulaProgram::Execute(CellReader&& read_cell, RangeReader&& read_range) const {
+    // only pathologically right-nested formulas need more than the inline stack
+    std::array<double, INLINE_STACK_SIZE> inline_stack;
+    std::vector<double> heap_stack;
+    double* stack = inline_stack.data();
+    if (max_depth_ > INLINE_STACK_SIZE) {
+        heap_stack.resize(max_depth_);
+        stack = heap_stack.data();
+    }
+
+    std::size_t top = 0;
+    bool arithmetic_error = false;
+    for (const Instruction& instruction : code_) {
+        switch (instruction.op) {
+        case OpCode::PushNumber:
+            stack[top++] = constants_[instruction.operand];
+            break;
+        case OpCode::PushCell: {
+            std::optional<double> value = read_cell(instruction.operand);
+            if (!value.has_value()) {
+                return FormulaError(FormulaError::Category::Value);
+            }
+            stack[top++] = *value;
+            break;
+        }
+        case OpCode::Negate:
+            stack[top - 1] = -stack[top - 1];
+            break;
+        case OpCode::Call: {
+            const Call& call = calls_[instruction.operand];
+            top -= call.value_count;
+            const double* values = stack + top;
+            std::size_t count = call.value_count;
+            // reading a range may evaluate other formulas on this thread, so
+            // the buffer is used as a stack: this call owns the part after base
+            std::vector<double>& buffer = GetCallBuffer();
+            const std::size_t base = buffer.size();
+            if (call.range_count > 0) {
+                buffer.insert(buffer.end(), values, values + count);
+                for (std::uint32_t i = 0; i < call.range_count; ++i) {
+                    if (!read_range(call.range_begin + i, buffer)) {
+                        buffer.resize(base);
+                        return FormulaError(FormulaError::Category::Value);
+                    }
+                }
+                values = buffer.data() + base;
+                count = buffer.size() - base;
+            }
+            // AVERAGE of nothing is a division by zero
+            const double result = call.function == Function::Average && count == 0
+                ? 0.0
+                : Aggregate(call.function, values, count);
+            arithmetic_error |= (call.function == Function::Average && count == 0) || !std::isfinite(result);
+            buffer.resize(base);
+            // written after the arguments are read: the first one shares the slot
+            stack[top++] = result;
+            break;
+        }
+        default: {
+            const double rhs = stack[--top];
+            double& lhs = stack[top - 1];
+            switch (instruction.op) {
+            case OpCode::Add:
+                lhs += rhs;
+                break;
+            case OpCode::Subtract:
+                lhs -= rhs;
+                break;
+            case OpCode::Multiply:
+                lhs *= rhs;
+                break;
+            default:
+                lhs /= rhs;
+                break;
+            }
+            arithmetic_error |= !std::isfinite(lhs);
+            break;
+        }
+        }
+    }
+
+    if (arithmetic_error) {
+        return FormulaError(FormulaError::Category::Arithmetic);
+    }
+    return stack[0];
+}
@@ -0,0 +1,89 @@
+#include "../common.h"
+#include "../formula.h"
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace std::literals;
+
+namespace {
+
+    // ((((A1+A2)+A3)+...)+An)
+    std::string MakeLeftNestedFormula(int depth) {
+        std::string result(depth - 1, '(');
+        result += "A1"s;
+        for (int i = 2; i <= depth; ++i) {
+            result += '+' + Position{ i - 1, 0 }.ToString() + ')';
+        }
+        return result;
+    }
+
+    // A1+(A2+(A3+...+(An-1+An)))
+    std::string MakeRightNestedFormula(int depth) {
+        std::string result;
+        for (int i = 1; i < depth; ++i) {
+            result += Position{ i - 1, 0 }.ToString() + "+("s;
+        }
+        result += Position{ depth - 1, 0 }.ToString();
+        result += std::string(depth - 1, ')');
+        return result;
+    }
+
+    // Время одного вычисления формулы в наносекундах
+    double MeasureEvaluate(const FormulaInterface& formula, const SheetInterface& sheet, int iterations) {
+        const auto start = std::chrono::steady_clock::now();
+        double checksum = 0;
+        for (int i = 0; i < iterations; ++i) {
+            const FormulaInterface::Value value = formula.Evaluate(sheet);
+            checksum += std::get<double>(value);
+        }
+        const auto finish = std::chrono::steady_clock::now();
+        if (checksum == 0) {
+            std::cerr << "unexpected zero result"sv << std::endl;
+        }
+        return std::chrono::duration<double, std::nano>(finish - start).count() / iterations;
+    }
+
+    // Возвращает время вычисления в пересчете на один узел формулы для максимальной глубины
+    // и проверяет, что оно растет не быстрее, чем линейно
+    bool RunSeries(const char* name, std::string (*make_formula)(int), const SheetInterface& sheet,
+                   const std::vector<int>& depths) {
+        std::cout << name << '\n';
+        std::cout << std::setw(8) << "depth"sv << std::setw(16) << "ns/eval"sv << std::setw(16) << "ns/node"sv << '\n';
+        double first_per_node = 0;
+        double last_per_node = 0;
+        for (int depth : depths) {
+            auto formula = ParseFormula(make_formula(depth));
+            const int iterations = std::max(20, 200000 / depth);
+            const double ns = MeasureEvaluate(*formula, sheet, iterations);
+            // depth ссылок на ячейки и depth - 1 сложений
+            const double per_node = ns / (2 * depth - 1);
+            if (first_per_node == 0) {
+                first_per_node = per_node;
+            }
+            last_per_node = per_node;
+            std::cout << std::setw(8) << depth << std::setw(16) << std::fixed << std::setprecision(1) << ns
+                      << std::setw(16) << per_node << '\n';
+        }
+        // с большим запасом на шум измерений: экспоненциальный рост дал бы разницу в десятки порядков
+        const bool is_linear = last_per_node < first_per_node * 10;
+        std::cout << (is_linear ? "linear: OK"sv : "linear: FAILED"sv) << "\n\n"sv;
+        return is_linear;
+    }
+
+}  // namespace
+
+int main() {
+    const std::vector<int> depths = { 10, 50, 100, 250, 500, 1000 };
+    auto sheet = CreateSheet();
+    for (int row = 0; row < depths.back(); ++row) {
+        sheet->SetCell(Position{ row, 0 }, std::to_string(row % 9 + 1));
+    }
+
+    bool is_linear = RunSeries("left nested", MakeLeftNestedFormula, *sheet, depths);
+    is_linear = RunSeries("right nested", MakeRightNestedFormula, *sheet, depths) && is_linear;
+    return is_linear ? 0 : 1;
+}
@@ -0,0 +1,743 @@
+#include "../common.h"
+#include "../formula.h"
+#include "../sheet_impl.h"
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+using namespace std::literals;
+
+// Счетчик выделений памяти всей программы: для каждого замера выводится
+// число выделений на операцию
+static std::atomic<std::uint64_t> allocation_count{ 0 };
+
+void* operator new(std::size_t size) {
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    if (void* ptr = std::malloc(size == 0 ? 1 : size)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+// GCC принимает free() в замененном operator delete за несоответствие new
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t /* size */) noexcept {
+    std::free(ptr);
+}
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic pop
+#endif
+
+namespace {
+
+    // Один замер: setup готовит данные и не входит во время, body выполняет
+    // items операций. Входные данные детерминированы, поэтому прогоны сравнимы.
+    // finish, если задан, вызывается после всех повторов и убирает то, что
+    // замер оставил вне процесса (временные файлы).
+    struct Case {
+        std::string name;
+        std::size_t items;
+        std::function<void()> setup;
+        std::function<void()> body;
+        std::function<void()> finish = {};
+    };
+
+    struct Result {
+        std::string name;
+        std::size_t items;
+        double real_ns;  // медиана по повторам, на одну операцию
+        double cpu_ns;
+        double allocations;
+        // рост пика резидентной памяти за время body над памятью перед ним и
+        // память, оставшаяся после body, в мегабайтах; разница - временная
+        // память операции. Нули, если ОС не дает сбросить пик (не Linux).
+        double peak_mb;
+        double kept_mb;
+    };
+
+    struct Options {
+        bool is_json = false;
+        std::string out_path;
+        std::string filter;
+        int repetitions = 5;
+        bool is_memory_report = false;
+        // примерный размер файла для замеров ImportTexts
+        std::uint64_t import_bytes = std::uint64_t(4) << 20;
+    };
+
+    // Чтобы компилятор не выбросил результат вычисления
+    volatile double sink = 0;
+
+    void Consume(const CellInterface::Value& value) {
+        if (const double* number = std::get_if<double>(&value)) {
+            sink = sink + *number;
+        }
+    }
+
+    std::vector<std::pair<Position, std::string>> MakeChain(int length) {
+        std::vector<std::pair<Position, std::string>> cells;
+        cells.reserve(length);
+        cells.emplace_back(Position{ 0, 0 }, "1"s);
+        for (int row = 1; row < length; ++row) {
+            cells.emplace_back(Position{ row, 0 }, "=A"s + std::to_string(row) + "+1"s);
+        }
+        return cells;
+    }
+
+    // Резидентная память процесса и ее пик из /proc/self/status, в мегабайтах
+    struct MemoryUsage {
+        double rss_mb = 0;
+        double peak_mb = 0;
+    };
+
+    MemoryUsage ReadMemoryUsage() {
+        MemoryUsage usage;
+        std::ifstream status("/proc/self/status");
+        std::string line;
+        while (std::getline(status, line)) {
+            auto read_kb = [&line](std::string_view key, double& mb) {
+                if (line.rfind(key, 0) == 0) {
+                    mb = std::strtod(line.c_str() + key.size(), nullptr) / 1024;
+                }
+            };
+            read_kb("VmRSS:"sv, usage.rss_mb);
+            read_kb("VmHWM:"sv, usage.peak_mb);
+        }
+        return usage;
+    }
+
+    // Возвращает ОС освобожденную память кучи, чтобы резидентная память
+    // показывала только живые объекты
+    void ReleaseFreeMemory() {
+#ifdef __GLIBC__
+        malloc_trim(0);
+#endif
+    }
+
+    // Сбрасывает пик резидентной памяти до текущей (Linux 4.0+)
+    bool ResetPeakMemory() {
+        std::ofstream clear_refs("/proc/self/clear_refs");
+        clear_refs << "5"sv;
+        clear_refs.flush();
+        return static_cast<bool>(clear_refs);
+    }
+
+    double Median(std::vector<double> values) {
+        std::sort(values.begin(), values.end());
+        return values[values.size() / 2];
+    }
+
+    Result Run(const Case& bench_case, int repetitions) {
+        std::vector<double> real;
+        std::vector<double> cpu;
+        std::vector<double> allocations;
+        std::vector<double> peak;
+        std::vector<double> kept;
+        for (int i = 0; i < repetitions; ++i) {
+            bench_case.setup();
+            ReleaseFreeMemory();
+            const bool is_peak_reset = ResetPeakMemory();
+            const MemoryUsage memory_start = ReadMemoryUsage();
+            const std::uint64_t allocations_start = allocation_count.load(std::memory_order_relaxed);
+            const std::clock_t cpu_start = std::clock();
+            const auto start = std::chrono::steady_clock::now();
+            bench_case.body();
+            const auto finish = std::chrono::steady_clock::now();
+            const std::clock_t cpu_finish = std::clock();
+            const std::uint64_t allocations_finish = allocation_count.load(std::memory_order_relaxed);
+            ReleaseFreeMemory();
+            const MemoryUsage memory_finish = ReadMemoryUsage();
+            real.push_back(std::chrono::duration<double, std::nano>(finish - start).count() / bench_case.items);
+            cpu.push_back(1e9 * (cpu_finish - cpu_start) / CLOCKS_PER_SEC / bench_case.items);
+            allocations.push_back(double(allocations_finish - allocations_start) / bench_case.items);
+            peak.push_back(is_peak_reset ? std::max(0.0, memory_finish.peak_mb - memory_start.rss_mb) : 0.0);
+            kept.push_back(is_peak_reset ? std::max(0.0, memory_finish.rss_mb - memory_start.rss_mb) : 0.0);
+        }
+        if (bench_case.finish) {
+            bench_case.finish();
+        }
+        return { bench_case.name, bench_case.items, Median(real), Median(cpu),
+                 Median(allocations), Median(peak), Median(kept) };
+    }
+
+    std::vector<Case> MakeCases(const Options& options) {
+        constexpr int CELLS = 100000;
+        constexpr int COLS = 26;
+        constexpr int CHAIN = 10000;
+        constexpr int FAN = 1000;
+        constexpr int PRINT_ROWS = 2000;
+
+        // общее состояние замеров; каждый setup создает лист заново
+        auto sheet = std::make_shared<std::unique_ptr<SheetImpl>>();
+        auto texts = std::make_shared<std::vector<std::pair<Position, std::string>>>();
+        auto formulas = std::make_shared<std::vector<std::pair<Position, std::string>>>();
+        for (int i = 0; i < CELLS; ++i) {
+            const Position pos{ i / COLS, i % COLS };
+            texts->emplace_back(pos, std::to_string(i % 97 + 1));
+            // формулы ниже блока текстов ссылаются на две его ячейки
+            formulas->emplace_back(Position{ pos.row + CELLS / COLS + 1, pos.col },
+                                   "="s + pos.ToString() + "*2+"s + Position{ pos.row, (pos.col + 1) % COLS }.ToString());
+        }
+        auto reset = [sheet] {
+            *sheet = std::make_unique<SheetImpl>();
+        };
+        auto load = [sheet, reset](const std::vector<std::pair<Position, std::string>>& cells) {
+            reset();
+            (*sheet)->SetCells(cells);
+        };
+
+        std::vector<Case> cases;
+
+        cases.push_back({ "SetCell/text", CELLS, reset, [sheet, texts] {
+            for (const auto& [pos, text] : *texts) {
+                (*sheet)->SetCell(pos, text);
+            }
+        } });
+
+        // формулы со ссылками на пустые позиции по всему листу, каждая - в
+        // своем блоке хранилища
+        auto far_formulas = std::make_shared<std::vector<std::pair<Position, std::string>>>();
+        for (int i = 0; i < CHAIN; ++i) {
+            const Position target{ Position::MAX_ROWS - 1 - i % 256 * 64, Position::MAX_COLS - 1 - i / 256 * 64 };
+            far_formulas->emplace_back(Position{ i, 0 }, "="s + target.ToString() + "+1"s);
+        }
+        cases.push_back({ "SetCell/far_reference", CHAIN, reset, [sheet, far_formulas] {
+            for (const auto& [pos, text] : *far_formulas) {
+                (*sheet)->SetCell(pos, text);
+            }
+        } });
+
+        cases.push_back({ "SetCell/formula", CELLS, [load, texts] { load(*texts); }, [sheet, formulas] {
+            for (const auto& [pos, text] : *formulas) {
+                (*sheet)->SetCell(pos, text);
+            }
+        } });
+
+        cases.push_back({ "SetCells/formula", CELLS, [load, texts] { load(*texts); }, [sheet, formulas] {
+            (*sheet)->SetCells(*formulas);
+        } });
+
+        // items_per_second - число разобранных формул в секунду
+        auto parse = [formulas](FormulaParserKind kind) {
+            return [formulas, kind] {
+                const FormulaParserKind previous = GetFormulaParser();
+                SetFormulaParser(kind);
+                for (const auto& [pos, text] : *formulas) {
+                    sink = sink + ParseFormula(text.substr(1))->GetReferencedCells().size();
+                }
+                SetFormulaParser(previous);
+            };
+        };
+        cases.push_back({ "ParseFormula/antlr", CELLS, [] {}, parse(FormulaParserKind::Antlr) });
+        cases.push_back({ "ParseFormula/pratt", CELLS, [] {}, parse(FormulaParserKind::Pratt) });
+
+        cases.push_back({ "GetValue/cold", CELLS, [sheet, load, texts, formulas] {
+            load(*texts);
+            (*sheet)->SetCells(*formulas);
+        }, [sheet, formulas] {
+            for (const auto& [pos, text] : *formulas) {
+                Consume((*sheet)->GetCell(pos)->GetValue());
+            }
+        } });
+
+        cases.push_back({ "GetValue/warm", CELLS, [sheet, load, texts, formulas] {
+            load(*texts);
+            (*sheet)->SetCells(*formulas);
+            (*sheet)->RecalculateAll();
+        }, [sheet, formulas] {
+            for (const auto& [pos, text] : *formulas) {
+                Consume((*sheet)->GetCell(pos)->GetValue());
+            }
+        } });
+
+        // полный пересчет однопоточно и по уровням в пуле из двух потоков:
+        // разница - цена построения уровней и синхронизации
+        for (const std::size_t thread_count : { std::size_t(1), std::size_t(2) }) {
+            cases.push_back({ "RecalculateAll/threads:"s + std::to_string(thread_count), CELLS,
+                              [sheet, load, texts, formulas, thread_count] {
+                load(*texts);
+                (*sheet)->SetCells(*formulas);
+                (*sheet)->SetRecalcThreadCount(thread_count);
+            }, [sheet] {
+                (*sheet)->RecalculateAll();
+            } });
+        }
+
+        // изменение начала цепочки и чтение ее конца
+        cases.push_back({ "Chain/OnDemand", CHAIN, [sheet, load] {
+            load(MakeChain(CHAIN));
+            (*sheet)->RecalculateAll();
+        }, [sheet] {
+            (*sheet)->SetCell(Position{ 0, 0 }, "2"s);
+            Consume((*sheet)->GetCell(Position{ CHAIN - 1, 0 })->GetValue());
+        } });
+
+        cases.push_back({ "Chain/Eager", CHAIN, [sheet, load] {
+            load(MakeChain(CHAIN));
+            (*sheet)->SetRecalcMode(Recalculator::Mode::Eager);
+            (*sheet)->RecalculateAll();
+        }, [sheet] {
+            (*sheet)->SetCell(Position{ 0, 0 }, "2"s);
+        } });
+
+        // одна формула со ссылками на FAN ячеек, каждая из которых изменяется
+        cases.push_back({ "FanIn", FAN, [sheet, load] {
+            std::vector<std::pair<Position, std::string>> cells;
+            std::string sum = "="s;
+            for (int row = 0; row < FAN; ++row) {
+                cells.emplace_back(Position{ row, 0 }, "1"s);
+                sum += (row > 0 ? "+A"s : "A"s) + std::to_string(row + 1);
+            }
+            cells.emplace_back(Position{ 0, 1 }, sum);
+            load(cells);
+        }, [sheet] {
+            for (int row = 0; row < FAN; ++row) {
+                (*sheet)->SetCell(Position{ row, 0 }, "2"s);
+                Consume((*sheet)->GetCell(Position{ 0, 1 })->GetValue());
+            }
+        } });
+
+        // то же через диапазон: SUM(A1:A<FAN>)
+        cases.push_back({ "FanIn/range", FAN, [sheet, load] {
+            std::vector<std::pair<Position, std::string>> cells;
+            for (int row = 0; row < FAN; ++row) {
+                cells.emplace_back(Position{ row, 0 }, "1"s);
+            }
+            cells.emplace_back(Position{ 0, 1 }, "=SUM(A1:A"s + std::to_string(FAN) + ")"s);
+            load(cells);
+        }, [sheet] {
+            for (int row = 0; row < FAN; ++row) {
+                (*sheet)->SetCell(Position{ row, 0 }, "2"s);
+                Consume((*sheet)->GetCell(Position{ 0, 1 })->GetValue());
+            }
+        } });
+
+        // CHAIN скользящих сумм B<i> = SUM(A<i>:A<i+9>): поиск зависящих от
+        // изменяемой ячейки формул среди CHAIN диапазонов
+        cases.push_back({ "SlidingSum", CHAIN, [sheet, load] {
+            std::vector<std::pair<Position, std::string>> cells;
+            for (int row = 0; row < CHAIN; ++row) {
+                cells.emplace_back(Position{ row, 0 }, "1"s);
+                cells.emplace_back(Position{ row, 1 }, "=SUM(A"s + std::to_string(row + 1) + ":A"s
+                                                       + std::to_string(row + 10) + ")"s);
+            }
+            load(cells);
+            (*sheet)->RecalculateAll();
+        }, [sheet] {
+            for (int row = 0; row < CHAIN; ++row) {
+                (*sheet)->SetCell(Position{ row, 0 }, "2"s);
+                Consume((*sheet)->GetCell(Position{ row, 1 })->GetValue());
+            }
+        } });
+
+        // CHAIN формул ссылаются на одну ячейку
+        cases.push_back({ "FanOut", CHAIN, [sheet, load] {
+            std::vector<std::pair<Position, std::string>> cells;
+            cells.emplace_back(Position{ 0, 0 }, "1"s);
+            for (int row = 0; row < CHAIN; ++row) {
+                cells.emplace_back(Position{ row, 1 }, "=A1+1"s);
+            }
+            load(cells);
+            (*sheet)->RecalculateAll();
+        }, [sheet] {
+            (*sheet)->SetCell(Position{ 0, 0 }, "2"s);
+            for (int row = 0; row < CHAIN; ++row) {
+                Consume((*sheet)->GetCell(Position{ row, 1 })->GetValue());
+            }
+        } });
+
+        // только сброс кэшей: изменение ячейки без чтения зависимых формул,
+        // время - на одну сброшенную формулу
+        cases.push_back({ "Invalidate/chain", CHAIN, [sheet, load] {
+            load(MakeChain(CHAIN));
+            (*sheet)->RecalculateAll();
+        }, [sheet] {
+            (*sheet)->SetCell(Position{ 0, 0 }, "2"s);
+        } });
+
+        cases.push_back({ "Invalidate/fanout", CHAIN, [sheet, load] {
+            std::vector<std::pair<Position, std::string>> cells;
+            cells.emplace_back(Position{ 0, 0 }, "1"s);
+            for (int row = 0; row < CHAIN; ++row) {
+                cells.emplace_back(Position{ row, 1 }, "=A1+1"s);
+            }
+            load(cells);
+            (*sheet)->RecalculateAll();
+        }, [sheet] {
+            (*sheet)->SetCell(Position{ 0, 0 }, "2"s);
+        } });
+
+        cases.push_back({ "ClearCell/with_dependents", CELLS, [load, texts, formulas] {
+            std::vector<std::pair<Position, std::string>> cells = *texts;
+            cells.insert(cells.end(), formulas->begin(), formulas->end());
+            load(cells);
+        }, [sheet, texts] {
+            for (const auto& [pos, text] : *texts) {
+                (*sheet)->ClearCell(pos);
+            }
+        } });
+
+        // очистка с конца листа: каждая очищенная ячейка - крайняя,
+        // время - на одну очистку с чтением границ
+        cases.push_back({ "ClearCell/edge", CELLS, [load, texts] { load(*texts); }, [sheet, texts] {
+            for (auto it = texts->rbegin(); it != texts->rend(); ++it) {
+                (*sheet)->ClearCell(it->first);
+                const Size size = (*sheet)->GetPrintableSize();
+                sink = sink + size.rows + size.cols;
+            }
+        } });
+
+        auto load_print = [load, texts, formulas] {
+            std::vector<std::pair<Position, std::string>> cells(texts->begin(), texts->begin() + PRINT_ROWS * COLS);
+            cells.insert(cells.end(), formulas->begin(), formulas->begin() + PRINT_ROWS * COLS);
+            load(cells);
+        };
+        const std::size_t print_cells = std::size_t(CELLS / COLS + 1 + PRINT_ROWS) * COLS;
+
+        cases.push_back({ "PrintValues", print_cells, [sheet, load_print] {
+            load_print();
+            (*sheet)->RecalculateAll();
+        }, [sheet] {
+            std::ostringstream output;
+            (*sheet)->PrintValues(output);
+            sink = sink + output.tellp();
+        } });
+
+        cases.push_back({ "PrintTexts", print_cells, load_print, [sheet] {
+            std::ostringstream output;
+            (*sheet)->PrintTexts(output);
+            sink = sink + output.tellp();
+        } });
+
+        // перезапуск с листом из 2 * CELLS ячеек: повтор SetCells по текстам с
+        // пересчетом против загрузки снимка с вычисленными значениями
+        const std::string snapshot_path = (std::filesystem::temp_directory_path() / "spreadsheet_bench.snapshot").string();
+        auto load_all = [sheet, load, texts, formulas] {
+            std::vector<std::pair<Position, std::string>> cells = *texts;
+            cells.insert(cells.end(), formulas->begin(), formulas->end());
+            load(cells);
+            (*sheet)->RecalculateAll();
+        };
+
+        // старый лист разрушается в setup и не входит во время
+        cases.push_back({ "Restart/replay", 2 * CELLS, [sheet] { sheet->reset(); }, [load_all] {
+            load_all();
+        } });
+
+        cases.push_back({ "Snapshot/save", 2 * CELLS, load_all, [sheet, snapshot_path] {
+            (*sheet)->SaveSnapshot(snapshot_path);
+        } });
+
+        cases.push_back({ "Snapshot/load", 2 * CELLS, [sheet, load_all, snapshot_path] {
+            load_all();
+            (*sheet)->SaveSnapshot(snapshot_path);
+            sheet->reset();
+        }, [sheet, snapshot_path] {
+            *sheet = SheetImpl::LoadSnapshot(snapshot_path);
+        } });
+        auto remove_snapshot = [snapshot_path] {
+            std::remove(snapshot_path.c_str());
+        };
+        cases[cases.size() - 2].finish = remove_snapshot;
+        cases.back().finish = remove_snapshot;
+
+        // загрузка текста в формате PrintTexts из файла размером около
+        // options.import_bytes: потоковое чтение с пакетной вставкой против
+        // чтения файла целиком и SetCell по полям. Лист занимает память по
+        // числу ячеек в обоих случаях, временная память (peak MB - kept MB)
+        // у потокового чтения не зависит от размера файла, у чтения целиком
+        // растет вместе с ним.
+        // Строка файла - числа в четных столбцах и формулы со ссылкой на
+        // соседа слева в нечетных; столбцов больше COLS, только если файл не
+        // помещается в Position::MAX_ROWS строк.
+        auto format_row = [](int row, int cols, std::string& line) {
+            line.clear();
+            for (int col = 0; col < cols; ++col) {
+                if (col > 0) {
+                    line += '\t';
+                }
+                if (col % 2 == 0) {
+                    line += std::to_string((row * 31 + col) % 997 + 1);
+                }
+                else {
+                    line += '=';
+                    line += Position{ row, col - 1 }.ToString();
+                    line += "*2+1"sv;
+                }
+            }
+            line += '\n';
+        };
+        std::string sample_row;
+        format_row(0, COLS, sample_row);
+        const std::uint64_t column_bytes = sample_row.size() / COLS + 1;
+        const int import_cols = static_cast<int>(std::clamp<std::uint64_t>(
+            options.import_bytes / (std::uint64_t(Position::MAX_ROWS) * column_bytes) + 1, COLS, Position::MAX_COLS));
+        format_row(Position::MAX_ROWS / 2, import_cols, sample_row);
+        const int import_rows = static_cast<int>(
+            std::clamp<std::uint64_t>(options.import_bytes / sample_row.size(), 1, Position::MAX_ROWS));
+        const std::size_t import_cells = std::size_t(import_rows) * import_cols;
+
+        // файл пишется один раз на замер, а не в каждом повторе
+        const std::string tsv_path = (std::filesystem::temp_directory_path() / "spreadsheet_bench.tsv").string();
+        auto is_tsv_written = std::make_shared<bool>(false);
+        auto write_tsv = [sheet, format_row, import_rows, import_cols, tsv_path, is_tsv_written] {
+            sheet->reset();
+            if (*is_tsv_written) {
+                return;
+            }
+            std::ofstream output(tsv_path, std::ios::binary | std::ios::trunc);
+            std::string line;
+            for (int row = 0; row < import_rows; ++row) {
+                format_row(row, import_cols, line);
+                output << line;
+            }
+            if (!output.flush()) {
+                throw std::runtime_error("cannot write "s + tsv_path);
+            }
+            *is_tsv_written = true;
+        };
+
+        cases.push_back({ "ImportTexts/stream", import_cells, write_tsv, [sheet, tsv_path] {
+            *sheet = std::make_unique<SheetImpl>();
+            std::ifstream input(tsv_path, std::ios::binary);
+            (*sheet)->ImportTexts(input);
+        } });
+
+        cases.push_back({ "ImportTexts/naive", import_cells, write_tsv, [sheet, tsv_path] {
+            *sheet = std::make_unique<SheetImpl>();
+            std::ifstream input(tsv_path, std::ios::binary);
+            std::stringstream content;
+            content << input.rdbuf();
+            std::string line;
+            for (int row = 0; std::getline(content, line); ++row) {
+                std::istringstream fields(line);
+                std::string field;
+                for (int col = 0; std::getline(fields, field, '\t'); ++col) {
+                    if (!field.empty()) {
+                        (*sheet)->SetCell(Position{ row, col }, field);
+                    }
+                }
+            }
+        } });
+        auto remove_tsv = [tsv_path, is_tsv_written] {
+            std::remove(tsv_path.c_str());
+            *is_tsv_written = false;
+        };
+        cases[cases.size() - 2].finish = remove_tsv;
+        cases.back().finish = remove_tsv;
+
+        return cases;
+    }
+
+    std::string EscapeJson(const std::string& text) {
+        std::string result;
+        for (char c : text) {
+            if (c == '"' || c == '\\') {
+                result += '\\';
+            }
+            result += c;
+        }
+        return result;
+    }
+
+    // Формат совместим с выводом Google Benchmark (--benchmark_format=json),
+    // чтобы прогоны можно было сравнивать его инструментами
+    void PrintJson(std::ostream& output, const std::vector<Result>& results, int repetitions) {
+        output << "{\n  \"context\": {\n"sv;
+        output << "    \"executable\": \"spreadsheet_bench\",\n"sv;
+        output << "    \"num_cpus\": "sv << std::thread::hardware_concurrency() << ",\n"sv;
+        output << "    \"repetitions\": "sv << repetitions << ",\n"sv;
+#ifdef NDEBUG
+        output << "    \"library_build_type\": \"release\"\n"sv;
+#else
+        output << "    \"library_build_type\": \"debug\"\n"sv;
+#endif
+        output << "  },\n  \"benchmarks\": [\n"sv;
+        output << std::fixed << std::setprecision(3);
+        for (std::size_t i = 0; i < results.size(); ++i) {
+            const Result& result = results[i];
+            output << "    {\n"sv;
+            output << "      \"name\": \""sv << EscapeJson(result.name) << "\",\n"sv;
+            output << "      \"run_type\": \"aggregate\",\n"sv;
+            output << "      \"aggregate_name\": \"median\",\n"sv;
+            output << "      \"iterations\": "sv << result.items << ",\n"sv;
+            output << "      \"real_time\": "sv << result.real_ns << ",\n"sv;
+            output << "      \"cpu_time\": "sv << result.cpu_ns << ",\n"sv;
+            output << "      \"time_unit\": \"ns\",\n"sv;
+            output << "      \"items_per_second\": "sv << 1e9 / result.real_ns << ",\n"sv;
+            output << "      \"allocations_per_item\": "sv << result.allocations << ",\n"sv;
+            output << "      \"peak_rss_mb\": "sv << result.peak_mb << ",\n"sv;
+            output << "      \"kept_rss_mb\": "sv << result.kept_mb << '\n';
+            output << (i + 1 < results.size() ? "    },\n"sv : "    }\n"sv);
+        }
+        output << "  ]\n}\n"sv;
+    }
+
+    void PrintTable(std::ostream& output, const std::vector<Result>& results) {
+        output << std::left << std::setw(28) << "benchmark"sv << std::right << std::setw(12) << "items"sv
+               << std::setw(14) << "ns/item"sv << std::setw(14) << "cpu ns/item"sv << std::setw(14) << "allocs/item"sv
+               << std::setw(10) << "peak MB"sv << std::setw(10) << "kept MB"sv << '\n';
+        output << std::fixed << std::setprecision(1);
+        for (const Result& result : results) {
+            output << std::left << std::setw(28) << result.name << std::right << std::setw(12) << result.items
+                   << std::setw(14) << result.real_ns << std::setw(14) << result.cpu_ns << std::setw(14)
+                   << result.allocations << std::setw(10) << result.peak_mb << std::setw(10) << result.kept_mb
+                   << '\n';
+        }
+    }
+
+    // Байты на ячейку каждого вида: числа, короткие и длинные тексты, формулы
+    // со ссылками и пустые позиции, на которые ссылаются формулы
+    void PrintMemoryReport(std::ostream& output) {
+        constexpr int ROWS = 10000;
+        SheetImpl sheet;
+        std::vector<std::pair<Position, std::string>> cells;
+        for (int row = 0; row < ROWS; ++row) {
+            const std::string index = std::to_string(row + 1);
+            cells.emplace_back(Position{ row, 0 }, index);
+            cells.emplace_back(Position{ row, 1 }, "text "s + index);
+            cells.emplace_back(Position{ row, 2 }, "a long text that does not fit into the string buffer "s + index);
+            cells.emplace_back(Position{ row, 3 }, "=E"s + index + "*2+1"s);
+        }
+        sheet.SetCells(std::move(cells));
+
+        const SheetImpl::MemoryReport report = sheet.GetMemoryReport();
+        output << std::left << std::setw(12) << "cells"sv << std::right << std::setw(12) << "count"sv
+               << std::setw(16) << "cell bytes"sv << std::setw(16) << "heap bytes"sv << '\n';
+        output << std::fixed << std::setprecision(1);
+        auto print = [&output](std::string_view name, const SheetImpl::CellMemory& memory) {
+            const double count = static_cast<double>(std::max<std::size_t>(memory.count, 1));
+            output << std::left << std::setw(12) << name << std::right << std::setw(12) << memory.count
+                   << std::setw(16) << memory.cell_bytes / count << std::setw(16) << memory.heap_bytes / count << '\n';
+        };
+        print("empty"sv, report.empty);
+        print("text"sv, report.text);
+        print("formula"sv, report.formula);
+        print("placeholder"sv, report.placeholders);
+    }
+
+    // Размер в байтах с необязательным суффиксом K, M или G
+    bool ParseSize(std::string_view text, std::uint64_t& bytes) {
+        int shift = 0;
+        const std::size_t suffix = text.empty() ? std::string_view::npos : "KMG"sv.find(text.back());
+        if (suffix != std::string_view::npos) {
+            shift = 10 * static_cast<int>(suffix + 1);
+            text.remove_suffix(1);
+        }
+        std::uint64_t number = 0;
+        const auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), number);
+        if (error != std::errc() || end != text.data() + text.size() || number == 0) {
+            return false;
+        }
+        bytes = number << shift;
+        return true;
+    }
+
+    bool ParseOptions(int argc, char** argv, Options& options) {
+        auto print_usage = [] {
+            std::cerr << "usage: spreadsheet_bench [--benchmark_format=console|json] [--benchmark_out=<file>]"sv
+                      << " [--benchmark_filter=<substring>] [--benchmark_repetitions=<n>] [--memory_report]"sv
+                      << " [--import_size=<bytes>[K|M|G]]"sv << std::endl;
+        };
+        for (int i = 1; i < argc; ++i) {
+            const std::string_view arg = argv[i];
+            auto value = [arg](std::string_view key) {
+                return arg.substr(key.size());
+            };
+            if (arg == "--benchmark_format=json"sv) {
+                options.is_json = true;
+            }
+            else if (arg == "--benchmark_format=console"sv) {
+                options.is_json = false;
+            }
+            else if (arg.rfind("--benchmark_out="sv, 0) == 0) {
+                options.out_path = std::string(value("--benchmark_out="sv));
+            }
+            else if (arg.rfind("--benchmark_filter="sv, 0) == 0) {
+                options.filter = std::string(value("--benchmark_filter="sv));
+            }
+            else if (arg == "--memory_report"sv) {
+                options.is_memory_report = true;
+            }
+            else if (arg.rfind("--benchmark_repetitions="sv, 0) == 0) {
+                options.repetitions = std::max(1, std::stoi(std::string(value("--benchmark_repetitions="sv))));
+            }
+            else if (arg.rfind("--import_size="sv, 0) == 0) {
+                if (!ParseSize(value("--import_size="sv), options.import_bytes)) {
+                    print_usage();
+                    return false;
+                }
+            }
+            else {
+                print_usage();
+                return false;
+            }
+        }
+        return true;
+    }
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!ParseOptions(argc, argv, options)) {
+        return 2;
+    }
+    if (options.is_memory_report) {
+        PrintMemoryReport(std::cout);
+        return 0;
+    }
+
+    std::vector<Result> results;
+    for (const Case& bench_case : MakeCases(options)) {
+        if (bench_case.name.find(options.filter) == std::string::npos) {
+            continue;
+        }
+        results.push_back(Run(bench_case, options.repetitions));
+    }
+
+    if (options.is_json) {
+        PrintJson(std::cout, results, options.repetitions);
+    }
+    else {
+        PrintTable(std::cout, results);
+    }
+    if (!options.out_path.empty()) {
+        std::ofstream out(options.out_path);
+        PrintJson(out, results, options.repetitions);
+        if (!out) {
+            std::cerr << "cannot write "sv << options.out_path << std::endl;
+            return 1;
+        }
+    }
+    return 0;
+}
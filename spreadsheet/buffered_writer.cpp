@@ -0,0 +1,128 @@
+#include "buffered_writer.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <locale>
+#include <ostream>
+#include <system_error>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace {
+void WriteToFd(int fd, const char* data, std::size_t size) {
+    while (size > 0) {
+#ifdef _WIN32
+        const int written = _write(fd, data, static_cast<unsigned>(std::min<std::size_t>(size, 1u << 30)));
+#else
+        const ssize_t written = ::write(fd, data, size);
+#endif
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::system_error(errno, std::generic_category(), "write");
+        }
+        data += written;
+        size -= static_cast<std::size_t>(written);
+    }
+}
+}  // namespace
+
+BufferedWriter::BufferedWriter(std::ostream& output)
+    : output_(&output)
+    , buffer_(new char[CAPACITY])
+    , precision_(static_cast<int>(output.precision())) {
+    const std::ios_base::fmtflags flags = output.flags();
+    const std::ios_base::fmtflags float_field = flags & std::ios_base::floatfield;
+    if (float_field == std::ios_base::fixed) {
+        format_ = std::chars_format::fixed;
+    }
+    else if (float_field == std::ios_base::scientific) {
+        format_ = std::chars_format::scientific;
+    }
+    // hexfloat (fixed | scientific) пишется с префиксом 0x, знак, точка и
+    // прописные буквы - флагами, разделители разрядов - локалью
+    is_stream_format_ = float_field == std::ios_base::floatfield
+        || (flags & (std::ios_base::showpos | std::ios_base::showpoint | std::ios_base::uppercase)) != 0
+        || output.getloc() != std::locale::classic();
+}
+
+BufferedWriter::BufferedWriter(int fd)
+    : fd_(fd)
+    , buffer_(new char[CAPACITY]) {
+}
+
+BufferedWriter::~BufferedWriter() = default;
+
+void BufferedWriter::Write(char c, std::size_t count) {
+    while (count > 0) {
+        if (size_ == CAPACITY) {
+            Flush();
+        }
+        const std::size_t chunk = std::min(count, CAPACITY - size_);
+        std::memset(buffer_.get() + size_, c, chunk);
+        size_ += chunk;
+        count -= chunk;
+    }
+}
+
+void BufferedWriter::Write(std::string_view text) {
+    // у пустого текста data() может быть nullptr, memcpy с ним не определен
+    if (text.empty()) {
+        return;
+    }
+    if (text.size() > CAPACITY - size_) {
+        Flush();
+        // длинный текст пишется мимо буфера
+        if (text.size() > CAPACITY) {
+            if (output_ != nullptr) {
+                output_->write(text.data(), static_cast<std::streamsize>(text.size()));
+            }
+            else {
+                WriteToFd(fd_, text.data(), text.size());
+            }
+            return;
+        }
+    }
+    std::memcpy(buffer_.get() + size_, text.data(), text.size());
+    size_ += text.size();
+}
+
+void BufferedWriter::Write(double value) {
+    if (is_stream_format_) {
+        Flush();
+        *output_ << value;
+        return;
+    }
+    char* const end = buffer_.get() + CAPACITY;
+    auto result = std::to_chars(buffer_.get() + size_, end, value, format_, precision_);
+    if (result.ec != std::errc()) {
+        Flush();
+        result = std::to_chars(buffer_.get(), end, value, format_, precision_);
+        // в пустой буфер не помещается только число с огромной точностью
+        if (result.ec != std::errc()) {
+            *output_ << value;
+            return;
+        }
+    }
+    size_ = static_cast<std::size_t>(result.ptr - buffer_.get());
+}
+
+void BufferedWriter::Flush() {
+    if (size_ == 0) {
+        return;
+    }
+    if (output_ != nullptr) {
+        output_->write(buffer_.get(), static_cast<std::streamsize>(size_));
+    }
+    else {
+        WriteToFd(fd_, buffer_.get(), size_);
+    }
+    size_ = 0;
+}
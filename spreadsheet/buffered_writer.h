@@ -0,0 +1,50 @@
+#pragma once
+
+#include <charconv>
+#include <cstddef>
+#include <iosfwd>
+#include <memory>
+#include <string_view>
+
+// Буферизованный вывод в поток или в файловый дескриптор. Текст и числа
+// форматируются прямо в буфер, который сбрасывается целиком при заполнении
+// и в Flush(). Деструктор не сбрасывает буфер: Flush() вызывается явно,
+// чтобы ошибка записи дошла до вызывающего.
+class BufferedWriter {
+public:
+    // Числа пишутся с точностью и форматом (fixed, scientific) потока на
+    // момент создания
+    explicit BufferedWriter(std::ostream& output);
+    // Дескриптор не закрывается; ошибка записи - std::system_error
+    explicit BufferedWriter(int fd);
+    BufferedWriter(const BufferedWriter&) = delete;
+    BufferedWriter& operator=(const BufferedWriter&) = delete;
+    ~BufferedWriter();
+
+    void Write(char c) {
+        if (size_ == CAPACITY) {
+            Flush();
+        }
+        buffer_[size_++] = c;
+    }
+
+    void Write(char c, std::size_t count);
+    void Write(std::string_view text);
+    // Как operator<< потока: с его настройками или, для дескриптора, с
+    // настройками по умолчанию (%g, 6 знаков)
+    void Write(double value);
+
+    void Flush();
+
+private:
+    static constexpr std::size_t CAPACITY = std::size_t(1) << 16;
+
+    std::ostream* output_ = nullptr;
+    int fd_ = -1;
+    std::unique_ptr<char[]> buffer_;
+    std::size_t size_ = 0;
+    std::chars_format format_ = std::chars_format::general;
+    int precision_ = 6;
+    // настройки потока, которых нет у to_chars: числа пишет сам поток
+    bool is_stream_format_ = false;
+};
@@ -1,190 +1,328 @@
 #include "cell.h"
 
-#include "sheet.h"
+#include "cell_storage.h"
+#include "sheet_impl.h"
 
+#include <algorithm>
 #include <cassert>
+#include <cmath>
 #include <iostream>
+#include <limits>
 #include <string>
+#include <new>
 #include <optional>
-#include <variant>
 
+using namespace std::literals;
 
-Cell::Cell(Sheet& sheet) : sheet_(sheet) {
+Cell::Cell() {
 }
-Cell::~Cell() = default;
 
-class Cell::Impl {
-public:
-    Impl() = default;
-    virtual ~Impl() = default;
-    virtual void Set(std::string text) = 0;
-    virtual Value GetValue() const = 0;
-    virtual std::string GetText() const = 0;
-    virtual bool IsFormula() const = 0;
-};
+Cell::~Cell() {
+    ResetContent();
+    if (dependencies_ != nullptr) {
+        CellStorage::GetDependencyPool(this).Delete(dependencies_);
+    }
+}
 
-class Cell::EmptyImpl : public Impl {
-public:
-    EmptyImpl() = default;
-    void Set(std::string text) override { }
-    Value GetValue() const override { return ""; }
-    std::string GetText() const override { return ""; }
-    bool IsFormula() const override { return false; }
-};
+namespace {
+double ParseTextNumber(std::string_view text) {
+    return CellInterface::ParseNumber(text[0] == ESCAPE_SIGN ? text.substr(1) : text)
+        .value_or(std::numeric_limits<double>::quiet_NaN());
+}
 
-class Cell::TextImpl : public Impl {
-public:
-    TextImpl() = default;
+const std::vector<Position> NO_CELLS;
+const std::vector<CellRange> NO_RANGES;
+const std::vector<Cell*> NO_UP_REFERENCES;
+}  // namespace
 
-    TextImpl(std::string text) :text_(std::move(text)) {};
+void Cell::Set(std::string_view text, Position pos) {
 
-       void Set(std::string text) override {
-           text_ = std::move(text);
-       }
+    if (text.size() > 1 && text[0] == '=') {
+        SetFormula(GetSheet().GetFormulaCache().Parse(text.substr(1), pos), pos);
+    }
+    else {
+        if (dependencies_ != nullptr) {
+            dependencies_->referenced_cells.clear();
+            dependencies_->referenced_ranges.clear();
+            ReleaseDependenciesIfUnused();
+        }
+        ResetContent();
+        if (!text.empty()) {
+            const double number = ParseTextNumber(text);
+            new (&text_) TextContent{ CompactString(text), number };
+            kind_ = Kind::Text;
+        }
+    }
+}
+
+void Cell::SetFormula(std::unique_ptr<FormulaInterface> formula, Position pos) {
+    std::vector<Position> cells = formula->GetReferencedCells();
+    std::vector<CellRange> ranges = formula->GetReferencedRanges();
+    if (!cells.empty() || !ranges.empty() || dependencies_ != nullptr) {
+        Dependencies& dependencies = GetDependencies();
+        dependencies.pos = pos;
+        dependencies.referenced_cells = std::move(cells);
+        dependencies.referenced_ranges = std::move(ranges);
+        ReleaseDependenciesIfUnused();
+    }
+    ResetContent();
+    new (&formula_) FormulaContent{ std::move(formula) };
+    kind_ = Kind::Formula;
+    state_ = CacheState::Empty;
+}
 
-    Value GetValue() const override {
-        return text_[0] == ESCAPE_SIGN ? text_.substr(1) : text_;
+void Cell::ResetContent() {
+    if (kind_ == Kind::Text) {
+        text_.~TextContent();
+    }
+    else if (kind_ == Kind::Formula) {
+        formula_.~FormulaContent();
     }
+    kind_ = Kind::Empty;
+}
 
-    std::string GetText() const override { return text_; }
+SheetImpl& Cell::GetSheet() const {
+    return CellStorage::GetSheet(this);
+}
 
-    bool IsFormula() const override { return false; }
+Cell::Dependencies& Cell::GetDependencies() {
+    if (dependencies_ == nullptr) {
+        dependencies_ = CellStorage::GetDependencyPool(this).New();
+    }
+    return *dependencies_;
+}
 
-private:
-    std::string text_;
-};
+void Cell::ReleaseDependenciesIfUnused() {
+    if (dependencies_ != nullptr && dependencies_->referenced_cells.empty()
+        && dependencies_->referenced_ranges.empty() && dependencies_->up_references.empty()) {
+        CellStorage::GetDependencyPool(this).Delete(dependencies_);
+        dependencies_ = nullptr;
+    }
+}
 
-class Cell::FormulaImpl : public Impl {
-public:
+const FormulaInterface* Cell::GetFormula() const {
+    const FormulaContent* content = GetFormulaContent();
+    return content != nullptr ? content->formula.get() : nullptr;
+}
 
-    explicit FormulaImpl(SheetInterface& sheet, std::string text) try
-        :sheet_(sheet), formula_(ParseFormula(text)){
+std::optional<FormulaInterface::Value> Cell::GetCachedValue() const {
+    const FormulaContent* content = GetFormulaContent();
+    if (content == nullptr || state_ == CacheState::Empty) {
+        return std::nullopt;
     }
-    catch (const FormulaException& fe) {
-        throw FormulaException(fe.what());
-    };
+    if (state_ == CacheState::Number) {
+        return content->value;
+    }
+    return FormulaError(static_cast<FormulaError::Category>(error_));
+}
 
-     void Set(std::string text) override {
-         try {
-             formula_ = ParseFormula(text);
-         }
-         catch (const FormulaException& fe) {
-             throw FormulaException(fe.what()); 
-         }
-     }
+void Cell::SetCachedValue(FormulaInterface::Value value) {
+    StoreCache(value);
+}
 
-    Value GetValue() const override {
-        using namespace std::literals;
-        if (cache_.has_value()) {
-            return cache_.value();
-        }
-        FormulaInterface::Value result = formula_->Evaluate(sheet_);
-        if (const double* result_ptr = std::get_if<double>(&result)) {
-            cache_ = *result_ptr;
-            return *result_ptr;
-        }
-        else {
-            cache_ = std::get<FormulaError>(result);
-            return std::get<FormulaError>(result);
-        }
+void Cell::StoreCache(const FormulaInterface::Value& value) const {
+    assert(IsFormula());
+    if (const double* number = std::get_if<double>(&value)) {
+        formula_.value = *number;
+        state_ = CacheState::Number;
+    }
+    else {
+        error_ = static_cast<std::uint8_t>(std::get<FormulaError>(value).GetCategory());
+        state_ = CacheState::Error;
     }
+}
 
-    void ClearCache() {
-        cache_.reset();
+void Cell::ClearCache() {
+    if (IsFormula()) {
+        state_ = CacheState::Empty;
     }
+}
+
+void Cell::Recalculate() const {
+    assert(IsFormula());
+    StoreCache(formula_.formula->Evaluate(GetSheet()));
+}
 
-    bool EmptyCache() {
-        return !cache_.has_value();
+bool Cell::MarkVisited(std::uint64_t epoch) const {
+    const FormulaContent* content = GetFormulaContent();
+    if (content == nullptr) {
+        return true;
     }
+    if (content->visit_epoch == epoch) {
+        return false;
+    }
+    content->visit_epoch = epoch;
+    return true;
+}
 
-    std::string GetText() const override {
-        return FORMULA_SIGN + formula_->GetExpression();
+std::uint64_t Cell::GetVisitEpoch() const {
+    const FormulaContent* content = GetFormulaContent();
+    return content != nullptr ? content->visit_epoch : 0;
+}
+
+void Cell::SetVisitEpoch(std::uint64_t epoch) const {
+    if (const FormulaContent* content = GetFormulaContent()) {
+        content->visit_epoch = epoch;
     }
+}
 
-    std::vector<Position> GetReferencedCells() {
-        return formula_->GetReferencedCells();
+std::uint32_t Cell::GetRecalcLevel() const {
+    return IsFormula() ? recalc_level_ : 0;
+}
+
+void Cell::SetRecalcLevel(std::uint32_t level) const {
+    if (IsFormula()) {
+        recalc_level_ = level;
     }
+}
 
-    bool IsFormula() const override { return true; }
+bool Cell::IsUpReferenced() const {
+    return dependencies_ != nullptr && !dependencies_->up_references.empty();
+}
 
-private:
-    SheetInterface& sheet_;
-    std::unique_ptr<FormulaInterface> formula_;
-    mutable std::optional<CellInterface::Value> cache_;
-};
+void Cell::MoveUpReferenceFromCell(Cell& other) {
+    SetUpReferences(other.TakeUpReferences());
+}
 
-void Cell::CheckCyclicity(Cell* cell_ptr) {
-    using namespace std::literals;
-    for (const Position& pos : cell_ptr->GetReferencedCells()) {
-        if (sheet_.GetCell(pos) == nullptr) {
-            continue;
-        }
-        if (disabling_cache_.count(sheet_.GetConcreteCell(pos)) > 0) {
-            throw CircularDependencyException(""s);
-        }
-        if (hold_cells_ptr_.count(sheet_.GetConcreteCell(pos)) < 1) {
-            disabling_cache_.insert(sheet_.GetConcreteCell(pos));
-            if (sheet_.GetConcreteCell(pos)->IsReferenced()) {
-                CheckCyclicity(sheet_.GetConcreteCell(pos));
-            }
-            disabling_cache_.erase(sheet_.GetConcreteCell(pos));
-            hold_cells_ptr_.insert(sheet_.GetConcreteCell(pos));
-        }
+std::vector<Cell*> Cell::TakeUpReferences() {
+    if (!IsUpReferenced()) {
+        return {};
     }
+    std::vector<Cell*> cells = std::move(dependencies_->up_references);
+    dependencies_->up_references.clear();
+    ReleaseDependenciesIfUnused();
+    return cells;
 }
 
-void Cell::Set(std::string text) {
-
-    if (text[0] == '=' && text.size() > 1) {
-        impl_ = std::make_unique<FormulaImpl>((SheetInterface&)sheet_, text.substr(1));
-        referenced_cell_ = static_cast<FormulaImpl*>(impl_.get())->GetReferencedCells();
-        disabling_cache_.clear();
-        hold_cells_ptr_.clear();
-        CheckCyclicity(this);
+void Cell::SetUpReferences(std::vector<Cell*> cells) {
+    if (!cells.empty()) {
+        GetDependencies().up_references = std::move(cells);
     }
-    else {
-        if (text.empty()) {
-            impl_ = std::make_unique<EmptyImpl>();
-        }
-        else {
-            impl_ = std::make_unique<TextImpl>(text);
-        }
+}
+
+void Cell::ReserveUpReferences(std::size_t count) {
+    if (count > 0) {
+        GetDependencies().up_references.reserve(count);
     }
 }
 
-void Cell::ClearCache() {
-    if (impl_->IsFormula()) {
-        (dynamic_cast<FormulaImpl*>(impl_.get()))->ClearCache();
+const std::vector<Cell*>& Cell::GetUpReferenceCells() const {
+    return dependencies_ != nullptr ? dependencies_->up_references : NO_UP_REFERENCES;
+}
+
+void Cell::InsertCellPtrToUpReferencedList(Cell* cell_ptr) {
+    std::vector<Cell*>& up_references = GetDependencies().up_references;
+    auto it = std::lower_bound(up_references.begin(), up_references.end(), cell_ptr, std::less<Cell*>());
+    if (it == up_references.end() || *it != cell_ptr) {
+        up_references.insert(it, cell_ptr);
     }
 }
 
-bool Cell::IsUpReferenced() const {
-    return !up_referenced_cell_.empty();
+void Cell::RemoveCellPtrFromUpReferencedList(Cell* cell_ptr) {
+    if (dependencies_ == nullptr) {
+        return;
+    }
+    std::vector<Cell*>& up_references = dependencies_->up_references;
+    auto it = std::lower_bound(up_references.begin(), up_references.end(), cell_ptr, std::less<Cell*>());
+    if (it != up_references.end() && *it == cell_ptr) {
+        up_references.erase(it);
+        ReleaseDependenciesIfUnused();
+    }
 }
 
-void Cell::CopyUpReferenceFromCell(Cell& other) {
-    up_referenced_cell_ = other.up_referenced_cell_;
+std::vector<Position> Cell::GetReferencedCells() const { 
+    return GetReferencedPositions();
 }
 
-std::unordered_set<Cell*> Cell::GetUpReferenceCells() {
-    return up_referenced_cell_;
+const std::vector<Position>& Cell::GetReferencedPositions() const {
+    return dependencies_ != nullptr ? dependencies_->referenced_cells : NO_CELLS;
 }
 
-void Cell::InsertCellPtrToUpReferencedList(Cell* cell_ptr) {
-    up_referenced_cell_.emplace(std::move(cell_ptr));
+const std::vector<CellRange>& Cell::GetReferencedRanges() const {
+    return dependencies_ != nullptr ? dependencies_->referenced_ranges : NO_RANGES;
 }
 
-std::vector<Position> Cell::GetReferencedCells() const { 
-    return referenced_cell_;
+Position Cell::GetPosition() const {
+    assert(IsReferenced());
+    return dependencies_->pos;
 }
 
 bool Cell::IsReferenced() const { 
-    return !referenced_cell_.empty();
+    return dependencies_ != nullptr
+        && (!dependencies_->referenced_cells.empty() || !dependencies_->referenced_ranges.empty());
 }
 
+std::size_t Cell::GetHeapSize() const {
+    std::size_t size = 0;
+    if (const TextContent* content = GetTextContent()) {
+        size += content->text.GetHeapSize();
+    }
+    if (dependencies_ != nullptr) {
+        size += sizeof(Dependencies) + dependencies_->referenced_cells.capacity() * sizeof(Position)
+            + dependencies_->referenced_ranges.capacity() * sizeof(CellRange)
+            + dependencies_->up_references.capacity() * sizeof(Cell*);
+    }
+    return size;
+}
+
+bool Cell::IsEmpty() const {
+    return kind_ == Kind::Empty;
+}
+
+std::string_view Cell::GetStoredText() const {
+    assert(!IsFormula());
+    const TextContent* content = GetTextContent();
+    return content != nullptr ? content->text.View() : std::string_view();
+}
+
+// Значение формулы вычисляет Recalculate(); без него формула может остаться
+// невычисленной только при циклической зависимости
 Cell::Value Cell::GetValue() const {
-    return impl_.get()->GetValue();
+    if (IsDirty()) {
+        GetSheet().RecalculateCell(this);
+    }
+    if (const TextContent* content = GetTextContent()) {
+        const std::string_view text = content->text.View();
+        return std::string(text[0] == ESCAPE_SIGN ? text.substr(1) : text);
+    }
+    if (const FormulaContent* content = GetFormulaContent()) {
+        switch (state_) {
+        case CacheState::Number:
+            return content->value;
+        case CacheState::Error:
+            return FormulaError(static_cast<FormulaError::Category>(error_));
+        default:
+            return FormulaError(FormulaError::Category::Value);
+        }
+    }
+    return ""s;
 }
+
+std::optional<double> Cell::GetNumber() const {
+    if (IsDirty()) {
+        GetSheet().RecalculateCell(this);
+    }
+    if (const TextContent* content = GetTextContent()) {
+        if (std::isnan(content->number)) {
+            return std::nullopt;
+        }
+        return content->number;
+    }
+    if (const FormulaContent* content = GetFormulaContent()) {
+        if (state_ == CacheState::Number) {
+            return content->value;
+        }
+        return std::nullopt;
+    }
+    return 0.0;
+}
+
 std::string Cell::GetText() const {
-    return impl_.get()->GetText();
-}
\ No newline at end of file
+    if (const TextContent* content = GetTextContent()) {
+        return std::string(content->text.View());
+    }
+    if (const FormulaContent* content = GetFormulaContent()) {
+        return FORMULA_SIGN + content->formula->GetExpression();
+    }
+    return ""s;
+}
@@ -1,43 +1,181 @@
 #pragma once
 
 #include "common.h"
+#include "compact_string.h"
 #include "formula.h"
 
+#include <cstdint>
 #include <functional>
-#include <unordered_set>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
 
-class Sheet;
+class CellStorage;
+class SheetImpl;
 
+// Ячейка не хранит ни лист, ни свою позицию: лист находится по блоку пула
+// хранилища, в котором размещена ячейка (CellStorage::GetSheet), позицию
+// передает вызывающий. Ячейки создаются только в хранилище листа.
 class Cell : public CellInterface {
 public:
-    Cell(Sheet& sheet);
+    Cell();
+    Cell(const Cell&) = delete;
+    Cell& operator=(const Cell&) = delete;
     ~Cell();
 
-    void Set(std::string text);
+    // Формула разделяется с ячейками того же вида через кэш формул листа,
+    // ссылки формулы отсчитываются от pos
+    void Set(std::string_view text, Position pos);
+    // Делает ячейку в pos формулой без разбора текста
+    void SetFormula(std::unique_ptr<FormulaInterface> formula, Position pos);
 
     Value GetValue() const override;
     std::string GetText() const override;
     std::vector<Position> GetReferencedCells() const override;
+    std::optional<double> GetNumber() const override;
+    bool IsEmpty() const override;
+    // Текст ячейки без копирования; только для текстовой и пустой ячейки
+    std::string_view GetStoredText() const;
+    // То же без копирования
+    const std::vector<Position>& GetReferencedPositions() const;
+    // Диапазоны - аргументы функций формулы
+    const std::vector<CellRange>& GetReferencedRanges() const;
+    // Позиция известна только формуле со ссылками (IsReferenced): она хранится
+    // вместе со ссылками, чтобы обходы зависимых находили формулы листа,
+    // ссылающиеся на нее через диапазоны
+    Position GetPosition() const;
+
+    bool IsFormula() const {
+        return kind_ == Kind::Formula;
+    }
 
     bool IsReferenced() const;
     bool IsUpReferenced() const;
-    void CopyUpReferenceFromCell(Cell& other);
+    // Забирает обратные ссылки other, у other они не остаются
+    void MoveUpReferenceFromCell(Cell& other);
+    // Забирает обратные ссылки ячейки, ее список остается пустым
+    std::vector<Cell*> TakeUpReferences();
+    // Задает обратные ссылки ячейки без них; cells упорядочены по адресу
+    void SetUpReferences(std::vector<Cell*> cells);
+    // Выделяет место под count обратных ссылок, чтобы их вставка не
+    // перевыделяла список
+    void ReserveUpReferences(std::size_t count);
     void InsertCellPtrToUpReferencedList(Cell* cell_ptr);
-    std::unordered_set<Cell*> GetUpReferenceCells();
+    void RemoveCellPtrFromUpReferencedList(Cell* cell_ptr);
+    // Ячейки, формулы которых ссылаются на данную, упорядочены по адресу.
+    // Формулы, ссылающиеся на ячейку через диапазон, здесь не хранятся.
+    const std::vector<Cell*>& GetUpReferenceCells() const;
     void ClearCache();
 
+    // nullptr для ячейки без формулы
+    const FormulaInterface* GetFormula() const;
+    // Кэш формулы без пересчета, std::nullopt - значение не вычислено
+    std::optional<FormulaInterface::Value> GetCachedValue() const;
+    void SetCachedValue(FormulaInterface::Value value);
+
+    // Формула без вычисленного значения
+    bool IsDirty() const {
+        return kind_ == Kind::Formula && state_ == CacheState::Empty;
+    }
+
+    // Вычисляет формулу и кэширует результат. Аргументы должны быть вычислены.
+    void Recalculate() const;
+    // Отметки обходов графа зависимостей хранятся только у формул: другие
+    // ячейки не бывают зависимыми и не попадают в обходы повторно.
+    // Отмечает ячейку посещенной в обходе epoch, false - если уже была отмечена
+    bool MarkVisited(std::uint64_t epoch) const;
+    std::uint64_t GetVisitEpoch() const;
+    void SetVisitEpoch(std::uint64_t epoch) const;
+    // Уровень формулы при пересчете по уровням; действителен только для
+    // ячеек, отмеченных текущим обходом
+    std::uint32_t GetRecalcLevel() const;
+    void SetRecalcLevel(std::uint32_t level) const;
+
+    // Память вне ячейки, которой она владеет: текст вне буфера строки и связи
+    // в графе зависимостей. Объект формулы не учитывается.
+    std::size_t GetHeapSize() const;
+
 private:
-    class Impl;
-    class EmptyImpl;
-    class TextImpl;
-    class FormulaImpl;
-
-    Sheet& sheet_;
-    std::unique_ptr<Impl> impl_;
-    std::vector<Position> referenced_cell_;
-    std::unordered_set<Cell*> up_referenced_cell_;
-    std::unordered_set<Cell*> disabling_cache_;
-    std::unordered_set<Cell*> hold_cells_ptr_;
-
-    void CheckCyclicity(Cell* cell_ptr);
+    // пул связей - в хранилище рядом с пулом ячеек
+    friend class CellStorage;
+
+    enum class Kind : std::uint8_t {
+        Empty,
+        Text,
+        Formula,
+    };
+
+    struct TextContent {
+        CompactString text;
+        // числовое значение текста разбирается один раз при записи; NaN -
+        // текст не число (ParseNumber не возвращает бесконечности и NaN)
+        double number;
+    };
+
+    enum class CacheState : std::uint8_t {
+        Empty,
+        Number,
+        Error,
+    };
+
+    // Состояние кэша, ошибка и уровень формулы лежат в ячейке вне
+    // содержимого, чтобы оно не было больше текста
+    struct FormulaContent {
+        std::unique_ptr<FormulaInterface> formula;
+        // Кэш пишется только в Recalculate(), читается после него. При
+        // параллельном пересчете ячейку вычисляет ровно один поток, а читающие
+        // ее формулы стоят на следующих уровнях, которые начинаются после
+        // завершения текущего.
+        mutable double value = 0.0;
+        mutable std::uint64_t visit_epoch = 0;
+    };
+
+    // Связи ячейки в графе зависимостей. Создаются только для формул со
+    // ссылками и для ячеек, на которые ссылаются формулы, в пуле хранилища и
+    // освобождаются, когда связей не остается.
+    struct Dependencies {
+        // позиция формулы; у ячейки без ссылок не задается
+        Position pos;
+        std::vector<Position> referenced_cells;
+        std::vector<CellRange> referenced_ranges;
+        std::vector<Cell*> up_references;
+    };
+
+    static_assert(sizeof(FormulaContent) <= sizeof(TextContent), "formula content must not widen the cell");
+
+    // Содержимое хранится в самой ячейке: пустая, текст или формула; активный
+    // член объединения задает kind_
+    union {
+        TextContent text_;
+        FormulaContent formula_;
+    };
+    Kind kind_ = Kind::Empty;
+    mutable CacheState state_ = CacheState::Empty;
+    // FormulaError::Category байтом: перечисление занимает int
+    mutable std::uint8_t error_ = 0;
+    mutable std::uint32_t recalc_level_ = 0;
+    // из пула хранилища, nullptr - связей нет
+    Dependencies* dependencies_ = nullptr;
+
+    const TextContent* GetTextContent() const {
+        return kind_ == Kind::Text ? &text_ : nullptr;
+    }
+
+    const FormulaContent* GetFormulaContent() const {
+        return kind_ == Kind::Formula ? &formula_ : nullptr;
+    }
+
+    void ResetContent();
+    void StoreCache(const FormulaInterface::Value& value) const;
+    SheetImpl& GetSheet() const;
+    Dependencies& GetDependencies();
+    void ReleaseDependenciesIfUnused();
 };
+
+// Бюджет ячейки - 48 байт: таблица виртуальных функций интерфейса, содержимое
+// на 24 байта (текст до 15 символов с числом или формула с кэшем и отметкой
+// обхода), тег с состоянием кэша и уровнем, указатель на связи. Пустая и
+// текстовая ячейка больше ничего не занимают, кроме текста длиннее 15 символов.
+static_assert(sizeof(Cell) <= 48, "Cell exceeds its size budget");
@@ -0,0 +1,56 @@
+#include "cell_storage.h"
+
+CellStorage::~CellStorage() {
+    for (const auto& tile : tiles_) {
+        if (tile == nullptr) {
+            continue;
+        }
+        for (Cell* cell : tile->cells) {
+            if (cell != nullptr) {
+                pool_.Delete(cell);
+            }
+        }
+    }
+}
+
+Cell* CellStorage::Put(Position pos, CellPtr cell) {
+    const std::size_t index = TileIndex(pos);
+    if (index >= tiles_.size()) {
+        // директория растет целыми строками блоков
+        tiles_.resize((index / TILES_PER_ROW + 1) * TILES_PER_ROW);
+    }
+    if (tiles_[index] == nullptr) {
+        tiles_[index] = std::make_unique<Tile>();
+    }
+    Tile& tile = *tiles_[index];
+    Cell*& place = tile.cells[CellIndex(pos)];
+    if (place != nullptr) {
+        pool_.Delete(place);
+    }
+    else {
+        ++tile.count;
+        rows_.Increment(pos.row);
+        cols_.Increment(pos.col);
+    }
+    place = cell.release();
+    return place;
+}
+
+void CellStorage::Erase(Position pos) {
+    const std::size_t index = TileIndex(pos);
+    if (index >= tiles_.size() || tiles_[index] == nullptr) {
+        return;
+    }
+    Tile& tile = *tiles_[index];
+    Cell*& place = tile.cells[CellIndex(pos)];
+    if (place == nullptr) {
+        return;
+    }
+    pool_.Delete(place);
+    place = nullptr;
+    rows_.Decrement(pos.row);
+    cols_.Decrement(pos.col);
+    if (--tile.count == 0) {
+        tiles_[index].reset();
+    }
+}
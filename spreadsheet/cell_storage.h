@@ -0,0 +1,158 @@
+#pragma once
+
+#include "cell.h"
+#include "common.h"
+#include "object_pool.h"
+#include "occupancy_counter.h"
+
+#include <algorithm>
+#include <array>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+class SheetImpl;
+
+// Разреженное хранилище ячеек листа. Лист разбит на блоки TILE_SIZE x TILE_SIZE,
+// блок выделяется при первой записи в него и освобождается, когда в нем не
+// остается ячеек. Внутри блока ячейки лежат по строкам, поэтому построчный обход
+// идет по соседним адресам. Сами ячейки и их связи в графе зависимостей
+// размещаются в пулах хранилища; по блоку пула ячейка находит хранилище, а
+// через него лист и пул связей.
+class CellStorage {
+public:
+    static constexpr int TILE_BITS = 6;
+    static constexpr int TILE_SIZE = 1 << TILE_BITS;
+    static constexpr int TILES_PER_ROW = Position::MAX_COLS / TILE_SIZE;
+
+    class Deleter {
+    public:
+        Deleter() = default;
+        explicit Deleter(ObjectPool<Cell, CellStorage>* pool) : pool_(pool) {}
+
+        void operator()(Cell* cell) const {
+            pool_->Delete(cell);
+        }
+
+    private:
+        ObjectPool<Cell, CellStorage>* pool_ = nullptr;
+    };
+
+    // Ячейка из пула хранилища, еще не размещенная на листе
+    using CellPtr = std::unique_ptr<Cell, Deleter>;
+
+    explicit CellStorage(SheetImpl& sheet) : sheet_(sheet) {}
+    CellStorage(const CellStorage&) = delete;
+    CellStorage& operator=(const CellStorage&) = delete;
+    ~CellStorage();
+
+    template <typename... Args>
+    CellPtr MakeCell(Args&&... args) {
+        return CellPtr(pool_.New(std::forward<Args>(args)...), Deleter(&pool_));
+    }
+
+    // Лист, хранилище которого создало cell
+    static SheetImpl& GetSheet(const Cell* cell) {
+        return ObjectPool<Cell, CellStorage>::GetOwner(cell)->sheet_;
+    }
+
+    // Пул связей хранилища, создавшего cell
+    static ObjectPool<Cell::Dependencies, CellStorage>& GetDependencyPool(const Cell* cell) {
+        return ObjectPool<Cell, CellStorage>::GetOwner(cell)->dependency_pool_;
+    }
+
+    // Ячейка в позиции или nullptr. Позиция должна быть корректной.
+    Cell* Get(Position pos) const {
+        const std::size_t index = TileIndex(pos);
+        if (index >= tiles_.size() || tiles_[index] == nullptr) {
+            return nullptr;
+        }
+        return tiles_[index]->cells[CellIndex(pos)];
+    }
+
+    // Размещает ячейку в позиции, прежняя ячейка удаляется
+    Cell* Put(Position pos, CellPtr cell);
+    void Erase(Position pos);
+
+    // Ограничивающий прямоугольник всех размещенных ячеек за O(1): число
+    // ячеек в каждой строке и столбце обновляется при Put() и Erase()
+    Size GetBounds() const {
+        return { rows_.GetEnd(), cols_.GetEnd() };
+    }
+
+    // Вызывает visitor(Cell*) для каждой размещенной ячейки
+    template <typename Visitor>
+    void ForEachCell(Visitor&& visitor) const {
+        for (const auto& tile : tiles_) {
+            if (tile == nullptr) {
+                continue;
+            }
+            for (Cell* cell : tile->cells) {
+                if (cell != nullptr) {
+                    visitor(cell);
+                }
+            }
+        }
+    }
+
+    // Вызывает visitor(Position, Cell*) или, если он не принимает позицию,
+    // visitor(Cell*) для каждой размещенной ячейки диапазона построчно;
+    // пропускаются только невыделенные блоки, ячейки блока берутся подряд
+    template <typename Visitor>
+    void ForEachCellIn(const CellRange& range, Visitor&& visitor) const {
+        const int first_tile_col = range.from.col >> TILE_BITS;
+        const int last_tile_col = range.to.col >> TILE_BITS;
+        for (int row = range.from.row; row <= range.to.row; ++row) {
+            const std::size_t row_index = std::size_t(row >> TILE_BITS) * TILES_PER_ROW;
+            if (row_index >= tiles_.size()) {
+                return;
+            }
+            for (int tile_col = first_tile_col; tile_col <= last_tile_col; ++tile_col) {
+                const Tile* tile = tiles_[row_index + tile_col].get();
+                if (tile == nullptr) {
+                    continue;
+                }
+                const int begin = std::max(range.from.col, tile_col << TILE_BITS);
+                const int end = std::min(range.to.col, ((tile_col + 1) << TILE_BITS) - 1);
+                Cell* const* cells = tile->cells.data() + std::size_t(row & (TILE_SIZE - 1)) * TILE_SIZE;
+                for (int col = begin; col <= end; ++col) {
+                    if (Cell* cell = cells[col & (TILE_SIZE - 1)]) {
+                        Visit(visitor, { row, col }, cell);
+                    }
+                }
+            }
+        }
+    }
+
+private:
+    struct Tile {
+        std::array<Cell*, TILE_SIZE * TILE_SIZE> cells{};
+        int count = 0;
+    };
+
+    SheetImpl& sheet_;
+    // объявлен раньше пула ячеек, чтобы пережить их
+    ObjectPool<Cell::Dependencies, CellStorage> dependency_pool_{ this };
+    ObjectPool<Cell, CellStorage> pool_{ this };
+    std::vector<std::unique_ptr<Tile>> tiles_;  // [tile_row * TILES_PER_ROW + tile_col]
+    OccupancyCounter rows_;
+    OccupancyCounter cols_;
+
+    template <typename Visitor>
+    static void Visit(Visitor& visitor, Position pos, Cell* cell) {
+        if constexpr (std::is_invocable_v<Visitor&, Position, Cell*>) {
+            visitor(pos, cell);
+        }
+        else {
+            visitor(cell);
+        }
+    }
+
+    static std::size_t TileIndex(Position pos) {
+        return std::size_t(pos.row >> TILE_BITS) * TILES_PER_ROW + (pos.col >> TILE_BITS);
+    }
+
+    static std::size_t CellIndex(Position pos) {
+        return std::size_t(pos.row & (TILE_SIZE - 1)) * TILE_SIZE + (pos.col & (TILE_SIZE - 1));
+    }
+};
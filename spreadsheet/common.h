@@ -1,10 +1,15 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
 #include <iosfwd>
+#include <functional>
 #include <memory>
+#include <optional>
 #include <stdexcept>
 #include <string>
 #include <string_view>
+#include <utility>
 #include <variant>
 #include <vector>
 
@@ -19,12 +24,25 @@ struct Position {
 
     bool IsValid() const;
     std::string ToString() const;
+    // ToString() без выделения памяти: пишет в buffer не больше
+    // MAX_STRING_LENGTH символов и возвращает их число, 0 - позиция некорректна
+    std::size_t ToChars(char* buffer) const;
 
     static Position FromString(std::string_view str);
 
+    // Корректная позиция в 32 битах: строка в старших битах, поэтому ключи
+    // упорядочены так же, как позиции. Ключ PositionTable и сортировки
+    // пакета SetCells
+    std::uint32_t Pack() const {
+        return static_cast<std::uint32_t>(row) << COL_BITS | static_cast<std::uint32_t>(col);
+    }
+
     static const int MAX_ROWS = 16384;
     static const int MAX_COLS = 16384;
     static const Position NONE;
+    static constexpr int COL_BITS = 14;
+    // XFD16384
+    static constexpr std::size_t MAX_STRING_LENGTH = 8;
 };
 
 struct Size {
@@ -34,6 +52,27 @@ struct Size {
     bool operator==(Size rhs) const;
 };
 
+// Прямоугольный диапазон ячеек, например A1:B5. Обе границы входят в диапазон,
+// from - левый верхний угол, to - правый нижний.
+struct CellRange {
+    Position from;
+    Position to;
+
+    bool operator==(const CellRange& rhs) const;
+    bool operator<(const CellRange& rhs) const;
+
+    bool IsValid() const;
+    bool Contains(Position pos) const;
+    std::string ToString() const;
+    // Как Position::ToChars()
+    std::size_t ToChars(char* buffer) const;
+
+    static constexpr std::size_t MAX_STRING_LENGTH = 2 * Position::MAX_STRING_LENGTH + 1;
+
+    // Диапазон по двум углам в любом порядке
+    static CellRange FromCorners(Position first, Position second);
+};
+
 // Описывает ошибки, которые могут возникнуть при вычислении формулы. ----- внес описание методов -----------
 class FormulaError {
 public:
@@ -93,6 +132,14 @@ public:
     using std::runtime_error::runtime_error;
 };
 
+// Исключение, выбрасываемое, если снимок листа не записан или не прочитан:
+// нет файла, другая версия формата или порядок байт, несовпадение контрольной
+// суммы, записи за границами секций
+class SnapshotException : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
+
 class CellInterface {
 public:
     // Либо текст ячейки, либо значение формулы, либо сообщение об ошибке из
@@ -114,6 +161,19 @@ public:
     // формуле. Список отсортирован по возрастанию и не содержит повторяющихся
     // ячеек. В случае текстовой ячейки список пуст.
     virtual std::vector<Position> GetReferencedCells() const = 0;
+
+    // Возвращает true для пустой ячейки
+    virtual bool IsEmpty() const;
+
+    // Возвращает значение ячейки как аргумента формулы: число, значение текста,
+    // если он целиком является числом, 0 для пустой ячейки. std::nullopt -
+    // текст не является числом или формула вычислена с ошибкой. По умолчанию
+    // вычисляется через GetValue().
+    virtual std::optional<double> GetNumber() const;
+
+    // Число, записанное текстом целиком (например, "3.5", "007", "-1e3"), или
+    // std::nullopt
+    static std::optional<double> ParseNumber(std::string_view text);
 };
 
 inline constexpr char FORMULA_SIGN = '=';
@@ -139,6 +199,13 @@ public:
     // начать текст со знака "=", но чтобы он не интерпретировался как формула.
     virtual void SetCell(Position pos, std::string text) = 0;
 
+    // Задаёт содержимое сразу нескольких ячеек, результат такой же, как у
+    // последовательных вызовов SetCell(). Если позиция встречается несколько
+    // раз, действует последнее значение. При некорректной позиции, формуле или
+    // циклической зависимости бросается соответствующее исключение и ни одна
+    // ячейка не изменяется.
+    virtual void SetCells(std::vector<std::pair<Position, std::string>> cells) = 0;
+
     // Возвращает значение ячейки.
     // Если ячейка пуста, может вернуть nullptr.
     virtual const CellInterface* GetCell(Position pos) const = 0;
@@ -160,6 +227,11 @@ public:
     // соответственно. Пустая ячейка представляется пустой строкой в любом случае.
     virtual void PrintValues(std::ostream& output) const = 0;
     virtual void PrintTexts(std::ostream& output) const = 0;
+
+    // Вызывает visitor для каждой непустой ячейки диапазона построчно, слева
+    // направо. По умолчанию перебирает все позиции диапазона через GetCell().
+    virtual void ForEachCellInRange(const CellRange& range,
+                                    const std::function<void(const CellInterface&)>& visitor) const;
 };
 
 // Создаёт готовую к работе пустую таблицу.
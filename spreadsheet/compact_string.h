@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <string_view>
+
+// Неизменяемая строка на 16 байт для текста ячейки: до INLINE_CAPACITY
+// символов хранятся в самом объекте, длинный текст - в куче ровно по длине.
+// Последний байт - свободное место встроенного буфера или HEAP_MARKER, за
+// которым указатель на текст и длина.
+class CompactString {
+public:
+    static constexpr std::size_t INLINE_CAPACITY = 15;
+
+    explicit CompactString(std::string_view text) {
+        if (text.size() <= INLINE_CAPACITY) {
+            std::memcpy(bytes_, text.data(), text.size());
+            bytes_[INLINE_CAPACITY] = static_cast<char>(INLINE_CAPACITY - text.size());
+            return;
+        }
+        if (text.size() > std::numeric_limits<std::uint32_t>::max()) {
+            throw std::length_error("text is too long");
+        }
+        char* data = new char[text.size()];
+        std::memcpy(data, text.data(), text.size());
+        const auto size = static_cast<std::uint32_t>(text.size());
+        std::memcpy(bytes_, &data, sizeof(data));
+        std::memcpy(bytes_ + sizeof(data), &size, sizeof(size));
+        bytes_[INLINE_CAPACITY] = HEAP_MARKER;
+    }
+
+    CompactString(const CompactString&) = delete;
+    CompactString& operator=(const CompactString&) = delete;
+
+    ~CompactString() {
+        if (IsOnHeap()) {
+            delete[] GetHeapData();
+        }
+    }
+
+    std::string_view View() const {
+        if (IsOnHeap()) {
+            std::uint32_t size;
+            std::memcpy(&size, bytes_ + sizeof(char*), sizeof(size));
+            return { GetHeapData(), size };
+        }
+        return { bytes_, INLINE_CAPACITY - static_cast<std::size_t>(bytes_[INLINE_CAPACITY]) };
+    }
+
+    // Байты текста в куче, 0 для короткого текста
+    std::size_t GetHeapSize() const {
+        return IsOnHeap() ? View().size() : 0;
+    }
+
+private:
+    static constexpr char HEAP_MARKER = static_cast<char>(0xFF);
+
+    alignas(char*) char bytes_[INLINE_CAPACITY + 1];
+
+    bool IsOnHeap() const {
+        return bytes_[INLINE_CAPACITY] == HEAP_MARKER;
+    }
+
+    char* GetHeapData() const {
+        char* data;
+        std::memcpy(&data, bytes_, sizeof(data));
+        return data;
+    }
+};
+
+static_assert(sizeof(CompactString) == 16, "CompactString must stay two words");
@@ -1,10 +1,12 @@
 #include "formula.h"
 
 #include "FormulaAST.h"
+#include "formula_template.h"
 
 #include <algorithm>
 #include <cassert>
 #include <cctype>
+#include <optional>
 #include <sstream>
 
 using namespace std::literals;
@@ -16,80 +18,351 @@ std::ostream& operator<<(std::ostream& output, FormulaError fe) {
 }
 
 namespace {
+// Числовое значение ячейки-аргумента формулы или std::nullopt, если ячейка не
+// может быть трактована как число.
+std::optional<double> ReadCellValue(const SheetInterface& sheet, Position pos) {
+    const CellInterface* cell = sheet.GetCell(pos);
+    if (cell == nullptr) {
+        return 0.0;
+    }
+    return cell->GetNumber();
+}
+
+// Добавляет в values числа диапазона: пустые ячейки и нечисловой текст
+// пропускаются, текст, целиком записывающий число (в том числе
+// экранированный), дает число; ошибка в ячейке диапазона делает false
+// результатом функции
+bool ReadRangeValues(const SheetInterface& sheet, const CellRange& range, std::vector<double>& values) {
+    bool is_valid = true;
+    sheet.ForEachCellInRange(range, [&values, &is_valid](const CellInterface& cell) {
+        if (std::optional<double> number = cell.GetNumber()) {
+            values.push_back(*number);
+        }
+        else if (std::holds_alternative<FormulaError>(cell.GetValue())) {
+            is_valid = false;
+        }
+    });
+    return is_valid;
+}
+
+CellRange ShiftRange(const CellRange& range, Position shift) {
+    return { { range.from.row + shift.row, range.from.col + shift.col },
+             { range.to.row + shift.row, range.to.col + shift.col } };
+}
+
+// Диапазоны программы, упорядоченные и без повторов
+std::vector<CellRange> GetSortedRanges(const FormulaProgram& program) {
+    std::vector<CellRange> ranges = program.GetRanges();
+    std::sort(ranges.begin(), ranges.end());
+    ranges.erase(std::unique(ranges.begin(), ranges.end()), ranges.end());
+    return ranges;
+}
+
+void CheckReferencedCells(const FormulaProgram& program) {
+    for (const auto& cell_position : program.GetCells()) {
+        if (!cell_position.IsValid()) {
+            throw FormulaError::Category::Ref;
+        }
+    }
+}
+
+// Каноническая запись выражения по дереву разбора
+std::string PrintExpression(const FormulaAST& ast) {
+    std::stringstream ss;
+    ast.PrintFormula(ss);
+    return ss.str();
+}
+
+// Формула вне кэша. Как и форма кэша, хранит только программу и запись
+// выражения: дерево разбора освобождается в конструкторе.
 class Formula : public FormulaInterface {
 public:
     explicit Formula(std::string expression) try
-        : ast_(ParseFormulaAST(expression)) {
+        : Formula(ParseFormulaAST(expression)) {
     } catch (...) {
         throw FormulaException("");
     }
-    
+
+
     Value Evaluate(const SheetInterface& sheet) const override {
-        std::unordered_map< std::string, double > args;
-        for (const Position& pos : GetReferencedCells()) {
-            const CellInterface* cell = sheet.GetCell(pos);
-            if (cell == nullptr) {
-                args.emplace(pos.ToString(),0.0);
+        const std::vector<Position>& cells = program_.GetCells();
+        const std::vector<CellRange>& ranges = program_.GetRanges();
+        return program_.Execute(
+            [&sheet, &cells](std::uint32_t slot) {
+                return ReadCellValue(sheet, cells[slot]);
+            },
+            [&sheet, &ranges](std::uint32_t index, std::vector<double>& values) {
+                return ReadRangeValues(sheet, ranges[index], values);
+            });
+    }
+
+    std::string GetExpression() const override {
+        return expression_;
+    }
+
+    std::vector<Position> GetReferencedCells() const override {
+        CheckReferencedCells(program_);
+        return program_.GetCells();
+    }
+
+    std::vector<CellRange> GetReferencedRanges() const override {
+        return ranges_;
+    }
+
+private:
+    FormulaProgram program_;
+    std::vector<CellRange> ranges_;
+    std::string expression_;
+
+    explicit Formula(const FormulaAST& ast)
+        : program_(ast.Compile())
+        , ranges_(GetSortedRanges(program_))
+        , expression_(PrintExpression(ast)) {
+    }
+};
+
+bool IsSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+bool IsDigit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+bool IsUpper(char c) {
+    return c >= 'A' && c <= 'Z';
+}
+
+// Копирует выражение в out, передавая каждую ссылку на ячейку в
+// on_cell(Position, out) вместо копирования. Числа копируются целиком, поэтому
+// экспонента 1E5 не принимается за ссылку, имена функций копируются как есть.
+// Возвращает false для символов вне грамматики и некорректных ссылок: такие
+// формулы не кэшируются.
+template <typename OnCell>
+bool RewriteCells(std::string_view expression, std::string& out, OnCell&& on_cell) {
+    std::size_t pos = 0;
+    while (pos < expression.size()) {
+        const char c = expression[pos];
+        if (IsUpper(c)) {
+            std::size_t end = pos;
+            while (end < expression.size() && IsUpper(expression[end])) {
+                ++end;
             }
-            else {
-                if (std::holds_alternative<double>(cell->GetValue())) {
-                    args.emplace(pos.ToString(), std::get<double>(cell->GetValue()));
-                }
-                else if (std::holds_alternative<FormulaError>(cell->GetValue())) {
-                    return FormulaError::Category::Value;
+            const std::size_t letters_end = end;
+            while (end < expression.size() && IsDigit(expression[end])) {
+                ++end;
+            }
+            if (end == letters_end) {
+                out.append(expression.substr(pos, end - pos));
+                pos = end;
+                continue;
+            }
+            const Position cell = Position::FromString(expression.substr(pos, end - pos));
+            if (!cell.IsValid()) {
+                return false;
+            }
+            on_cell(cell, out);
+            pos = end;
+        }
+        else if (IsDigit(c) || c == '.') {
+            std::size_t end = pos;
+            while (end < expression.size() && (IsDigit(expression[end]) || expression[end] == '.')) {
+                ++end;
+            }
+            if (end < expression.size() && (expression[end] == 'e' || expression[end] == 'E')) {
+                ++end;
+                if (end < expression.size() && (expression[end] == '+' || expression[end] == '-')) {
+                    ++end;
                 }
-                else {
-                    std::string str = std::get<std::string>(cell->GetValue());
-                    int value_int = 0;
-                    try {
-                        value_int = std::stoi(str);
-                    }
-                    catch (...) {
-                        return FormulaError::Category::Value;
-                    }
-                    int length_value_int = 0;
-                    while (value_int) {
-                        value_int = value_int / 10;
-                        length_value_int++;
-                    }
-                    if (length_value_int == int(str.size())) {
-                        args.emplace(pos.ToString(), std::stoi(str) * 1.0);
-                    }
-                    else {
-                        return FormulaError::Category::Value;
-                    }
+                while (end < expression.size() && IsDigit(expression[end])) {
+                    ++end;
                 }
             }
+            out.append(expression.substr(pos, end - pos));
+            pos = end;
         }
-        try {
-            return ast_.Execute(args);
+        else if (IsSpace(c) || c == '+' || c == '-' || c == '*' || c == '/' || c == '(' || c == ')'
+                 || c == ':' || c == ',') {
+            out += c;
+            ++pos;
         }
-        catch (const FormulaError& err) {
-            return err;
+        else {
+            return false;
         }
     }
+    return true;
+}
+}  // namespace
+
+std::unique_ptr<FormulaInterface> ParseFormula(std::string expression) {
+    return std::make_unique<Formula>(std::move(expression));
+}
+
+FormulaCache::Template::Template(std::string_view expression, Position anchor) try
+    : anchor_(anchor) {
+    // дерево нужно только для компиляции и канонической записи выражения
+    FormulaAST ast = ParseFormulaAST(std::string(expression));
+    expression_ = PrintExpression(ast);
+    program_ = ast.Compile();
+    ranges_ = GetSortedRanges(program_);
+} catch (...) {
+    throw FormulaException("");
+}
+
+FormulaCache::Template::Template(std::string expression, Position anchor, FormulaProgram program)
+    : program_(std::move(program))
+    , ranges_(GetSortedRanges(program_))
+    , anchor_(anchor)
+    , expression_(std::move(expression)) {
+}
+
+FormulaInterface::Value FormulaCache::Template::Evaluate(const SheetInterface& sheet, Position shift) const {
+    const std::vector<Position>& cells = program_.GetCells();
+    const std::vector<CellRange>& ranges = program_.GetRanges();
+    return program_.Execute(
+        [&sheet, &cells, shift](std::uint32_t slot) {
+            return ReadCellValue(sheet, { cells[slot].row + shift.row, cells[slot].col + shift.col });
+        },
+        [&sheet, &ranges, shift](std::uint32_t index, std::vector<double>& values) {
+            return ReadRangeValues(sheet, ShiftRange(ranges[index], shift), values);
+        });
+}
+
+namespace {
+// Формула ячейки, разделяющая разобранную форму с другими ячейками
+class SharedFormula : public FormulaInterface {
+public:
+    SharedFormula(std::shared_ptr<const FormulaCache::Template> shared, Position shift)
+        : shared_(std::move(shared))
+        , shift_(shift) {
+    }
+
+    Value Evaluate(const SheetInterface& sheet) const override {
+        return shared_->Evaluate(sheet, shift_);
+    }
 
     std::string GetExpression() const override {
-        std::stringstream ss;
-        ast_.PrintFormula(ss);
-        return ss.str();
+        if (shift_ == Position{ 0, 0 }) {
+            return shared_->GetExpression();
+        }
+        std::string result;
+        result.reserve(shared_->GetExpression().size());
+        RewriteCells(shared_->GetExpression(), result, [this](Position cell, std::string& out) {
+            char buffer[Position::MAX_STRING_LENGTH];
+            out.append(buffer, Position{ cell.row + shift_.row, cell.col + shift_.col }.ToChars(buffer));
+        });
+        return result;
     }
 
     std::vector<Position> GetReferencedCells() const override {
-        for (const auto& cell_position : ast_.GetCells()) {  
-            if (!cell_position.IsValid()) {
-                throw FormulaError::Category::Ref;
-            }
+        // сдвиг сохраняет порядок позиций
+        CheckReferencedCells(shared_->GetProgram());
+        std::vector<Position> cells = shared_->GetProgram().GetCells();
+        for (Position& cell : cells) {
+            cell.row += shift_.row;
+            cell.col += shift_.col;
         }
-        std::set<Position> set_position{ ast_.GetCells().begin(), ast_.GetCells().end() };
-        return { set_position.begin(), set_position.end() };  
+        return cells;
+    }
+
+    std::vector<CellRange> GetReferencedRanges() const override {
+        std::vector<CellRange> ranges = shared_->GetRanges();
+        for (CellRange& range : ranges) {
+            range = ShiftRange(range, shift_);
+        }
+        return ranges;
+    }
+
+    const std::shared_ptr<const FormulaCache::Template>& GetTemplate() const {
+        return shared_;
     }
 
 private:
-    FormulaAST ast_;
+    std::shared_ptr<const FormulaCache::Template> shared_;
+    Position shift_;
 };
+
+// Кэш просматривается на неиспользуемые формы, когда вырастает вдвое
+constexpr std::size_t MIN_SWEEP_SIZE = 1024;
 }  // namespace
 
-std::unique_ptr<FormulaInterface> ParseFormula(std::string expression) {
-    return std::make_unique<Formula>(std::move(expression));
-}
\ No newline at end of file
+FormulaCache::FormulaCache()
+    : sweep_size_(MIN_SWEEP_SIZE) {
+}
+
+FormulaCache::~FormulaCache() = default;
+
+std::unique_ptr<FormulaInterface> FormulaCache::Parse(std::string_view expression, Position anchor) {
+    if (!BuildKey(expression, anchor)) {
+        return ParseFormula(std::string(expression));
+    }
+
+    auto it = templates_.find(key_);
+    if (it == templates_.end()) {
+        auto shared = std::make_shared<const Template>(expression, anchor);
+        if (templates_.size() >= sweep_size_) {
+            Sweep();
+        }
+        it = templates_.emplace(key_, std::move(shared)).first;
+    }
+    return std::make_unique<SharedFormula>(it->second, it->second->GetShift(anchor));
+}
+
+std::shared_ptr<const FormulaCache::Template> FormulaCache::Intern(std::shared_ptr<const Template> shared) {
+    // ключ строится для ячейки, по которой записано выражение формы; форма с
+    // некэшируемой записью (например, inf) разделяется только ее владельцами
+    if (!BuildKey(shared->GetExpression(), shared->GetAnchor())) {
+        return shared;
+    }
+    auto it = templates_.find(key_);
+    if (it == templates_.end()) {
+        if (templates_.size() >= sweep_size_) {
+            Sweep();
+        }
+        it = templates_.emplace(key_, std::move(shared)).first;
+    }
+    return it->second;
+}
+
+std::unique_ptr<FormulaInterface> FormulaCache::Share(std::shared_ptr<const Template> shared, Position anchor) {
+    const Position shift = shared->GetShift(anchor);
+    return std::make_unique<SharedFormula>(std::move(shared), shift);
+}
+
+std::shared_ptr<const FormulaCache::Template> FormulaCache::GetTemplate(const FormulaInterface& formula) {
+    const auto* shared = dynamic_cast<const SharedFormula*>(&formula);
+    if (shared == nullptr) {
+        return nullptr;
+    }
+    return shared->GetTemplate();
+}
+
+std::size_t FormulaCache::GetSize() const {
+    std::size_t size = 0;
+    for (const auto& [key, shared] : templates_) {
+        size += shared.use_count() > 1;
+    }
+    return size;
+}
+
+void FormulaCache::Sweep() {
+    for (auto it = templates_.begin(); it != templates_.end();) {
+        if (it->second.use_count() == 1) {
+            it = templates_.erase(it);
+        }
+        else {
+            ++it;
+        }
+    }
+    sweep_size_ = std::max(MIN_SWEEP_SIZE, 2 * templates_.size());
+}
+bool FormulaCache::BuildKey(std::string_view expression, Position anchor) {
+    key_.clear();
+    // сдвиг пишется байтами после '{', которой нет в выражениях: ключ
+    // однозначен и строится без преобразования чисел в текст
+    return RewriteCells(expression, key_, [anchor](Position cell, std::string& out) {
+        const std::int32_t shift[2] = { cell.row - anchor.row, cell.col - anchor.col };
+        out += '{';
+        out.append(reinterpret_cast<const char*>(shift), sizeof(shift));
+    });
+}
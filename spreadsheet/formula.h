@@ -3,6 +3,8 @@
 #include "common.h"
 
 #include <memory>
+#include <string_view>
+#include <unordered_map>
 #include <vector>
 
 class FormulaInterface {
@@ -16,6 +18,59 @@ public:
     virtual std::string GetExpression() const = 0;
 
     virtual std::vector<Position> GetReferencedCells() const = 0;
+
+    // Диапазоны - аргументы функций (SUM(A1:B5)), упорядочены и без повторов.
+    // Ячейки диапазонов не входят в GetReferencedCells().
+    virtual std::vector<CellRange> GetReferencedRanges() const = 0;
 };
 
 std::unique_ptr<FormulaInterface> ParseFormula(std::string expression);
+
+// Разборщик формул, которым пользуется ParseFormula(). Оба строят одинаковое
+// дерево и одинаково реагируют на ошибки. По умолчанию выбирается при сборке
+// опцией SPREADSHEET_FORMULA_PARSER.
+enum class FormulaParserKind {
+    Antlr,  // сгенерированный ANTLR по Formula.g4
+    Pratt,  // написанный вручную, без промежуточного дерева разбора
+};
+
+void SetFormulaParser(FormulaParserKind kind);
+FormulaParserKind GetFormulaParser();
+
+// Кэш разобранных формул листа. Формулы, совпадающие с точностью до сдвига
+// ссылок относительно своей ячейки (=A1*B1 в C1 и =A2*B2 в C2), разделяют одну
+// скомпилированную программу, у каждой ячейки остается только сдвиг
+// относительно ячейки, для которой формула была разобрана.
+class FormulaCache {
+public:
+    class Template;
+
+    FormulaCache();
+    FormulaCache(const FormulaCache&) = delete;
+    FormulaCache& operator=(const FormulaCache&) = delete;
+    ~FormulaCache();
+
+    // Разбирает формулу ячейки anchor, исключения - как у ParseFormula()
+    std::unique_ptr<FormulaInterface> Parse(std::string_view expression, Position anchor);
+    // Добавляет готовую форму, например загруженную из снимка; возвращает
+    // форму того же вида из кэша, если она уже есть
+    std::shared_ptr<const Template> Intern(std::shared_ptr<const Template> shared);
+    // Формула ячейки anchor по форме из Intern()
+    static std::unique_ptr<FormulaInterface> Share(std::shared_ptr<const Template> shared, Position anchor);
+    // Форма формулы ячейки anchor, ссылки которой сдвинуты на anchor минус
+    // Template::GetAnchor(); nullptr, если формула разобрана вне кэша
+    static std::shared_ptr<const Template> GetTemplate(const FormulaInterface& formula);
+
+    // Число различных форм формул, используемых ячейками
+    std::size_t GetSize() const;
+
+private:
+    // ключ - выражение, в котором ссылки заменены сдвигами относительно anchor
+    std::unordered_map<std::string, std::shared_ptr<const Template>> templates_;
+    std::string key_;
+    std::size_t sweep_size_;
+
+    // Строит key_; false, если выражение не кэшируется
+    bool BuildKey(std::string_view expression, Position anchor);
+    void Sweep();
+};
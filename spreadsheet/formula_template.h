@@ -0,0 +1,50 @@
+#pragma once
+
+#include "FormulaProgram.h"
+#include "formula.h"
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Разобранная форма формулы: программа и каноническая запись выражения для
+// ячейки anchor. Дерево разбора не хранится, поэтому форму можно восстановить
+// из снимка листа без разбора.
+class FormulaCache::Template {
+public:
+    // Разбирает формулу, исключения - как у ParseFormula()
+    Template(std::string_view expression, Position anchor);
+    // Форма из готовой программы; expression - ее запись для anchor
+    Template(std::string expression, Position anchor, FormulaProgram program);
+
+    // Значение формулы, все ссылки которой сдвинуты на shift
+    FormulaInterface::Value Evaluate(const SheetInterface& sheet, Position shift) const;
+
+    const FormulaProgram& GetProgram() const {
+        return program_;
+    }
+
+    // Упорядочены и без повторов
+    const std::vector<CellRange>& GetRanges() const {
+        return ranges_;
+    }
+
+    Position GetAnchor() const {
+        return anchor_;
+    }
+
+    // Сдвиг ссылок формулы ячейки anchor относительно разобранной
+    Position GetShift(Position anchor) const {
+        return { anchor.row - anchor_.row, anchor.col - anchor_.col };
+    }
+
+    const std::string& GetExpression() const {
+        return expression_;
+    }
+
+private:
+    FormulaProgram program_;
+    std::vector<CellRange> ranges_;
+    Position anchor_;
+    std::string expression_;
+};
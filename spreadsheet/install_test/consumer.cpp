@@ -0,0 +1,56 @@
+#include <common.h>
+#include <sheet.h>
+
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+
+// Собирается только по установленным заголовкам и библиотекам: каждая
+// проверка использует часть публичного интерфейса Sheet
+namespace {
+
+    bool Check(bool condition, const char* what) {
+        if (!condition) {
+            std::cerr << "install_test: " << what << std::endl;
+        }
+        return condition;
+    }
+
+    bool HasValue(const SheetInterface& sheet, const char* pos, double expected) {
+        const CellInterface* cell = sheet.GetCell(Position::FromString(pos));
+        return cell != nullptr && cell->GetValue() == CellInterface::Value(expected);
+    }
+
+}  // namespace
+
+int main() {
+    std::unique_ptr<SheetInterface> created = CreateSheet();
+    created->SetCells({ { Position::FromString("A1"), "2" }, { Position::FromString("B1"), "=A1*3" } });
+    bool ok = Check(HasValue(*created, "B1", 6.0), "SetCells through CreateSheet");
+
+    Sheet sheet;
+    std::istringstream input("1\t=A1+1\n=B1*10\n");
+    sheet.ImportTexts(input);
+    ok = Check(HasValue(sheet, "A2", 20.0), "ImportTexts") && ok;
+
+    const std::string path = "spreadsheet_consumer.snapshot";
+    sheet.SaveSnapshot(path);
+    std::unique_ptr<Sheet> loaded = Sheet::LoadSnapshot(path);
+    std::remove(path.c_str());
+    ok = Check(loaded->GetPrintableSize() == sheet.GetPrintableSize(), "snapshot size") && ok;
+    ok = Check(HasValue(*loaded, "A2", 20.0), "snapshot values") && ok;
+
+    // снимок удален: ошибка чтения приходит исключением из common.h
+    bool is_caught = false;
+    try {
+        Sheet::LoadSnapshot(path);
+    }
+    catch (const SnapshotException&) {
+        is_caught = true;
+    }
+    ok = Check(is_caught, "SnapshotException") && ok;
+
+    return ok ? 0 : 1;
+}
@@ -1,5 +1,19 @@
+#include "FormulaAST.h"
 #include "common.h"
+#include "sheet.h"
+#include "sheet_impl.h"
+#include "snapshot.h"
 #include "test_runner_p.h"
+#include "tsv_reader.h"
+
+#include <algorithm>
+#include <clocale>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iterator>
+#include <sstream>
 
 inline std::ostream& operator<<(std::ostream& output, Position pos) {
     return output << "(" << pos.row << ", " << pos.col << ")";
@@ -48,6 +62,34 @@ namespace {
         }
     }
 
+    void TestPositionConversion() {
+        ASSERT_EQUAL(Position::FromString("A1"), Position({ 0, 0 }));
+        ASSERT_EQUAL(Position::FromString("AA10"), Position({ 9, 26 }));
+        ASSERT_EQUAL(Position::FromString("XFD16384"), Position({ 16383, 16383 }));
+        ASSERT_EQUAL(Position({ 16383, 16383 }).ToString(), "XFD16384");
+        ASSERT_EQUAL(Position::FromString("A007"), Position({ 6, 0 }));
+        for (const char* invalid : { "", "A", "1", "a1", "ABCD1", "A1B", "A-1", "A+1", "A99999999999" }) {
+            ASSERT_EQUAL(Position::FromString(invalid), Position::NONE);
+        }
+        ASSERT_EQUAL(Position::NONE.ToString(), "");
+        ASSERT_EQUAL(CellRange({ "A1"_pos, "XFD16384"_pos }).ToString(), "A1:XFD16384");
+
+        // все столбцы и упаковка в порядке позиций
+        std::uint32_t previous_key = 0;
+        for (int col = 0; col < Position::MAX_COLS; ++col) {
+            for (int row : { 0, 99, Position::MAX_ROWS - 1 }) {
+                const Position pos{ row, col };
+                char buffer[Position::MAX_STRING_LENGTH];
+                const std::string_view text(buffer, pos.ToChars(buffer));
+                ASSERT_EQUAL(Position::FromString(text), pos);
+            }
+            const std::uint32_t key = Position{ 0, col }.Pack();
+            ASSERT(col == 0 || previous_key < key);
+            previous_key = key;
+        }
+        ASSERT(Position({ 0, Position::MAX_COLS - 1 }).Pack() < Position({ 1, 0 }).Pack());
+    }
+
     void TestSetCellPlainText() {
         auto sheet = CreateSheet();
 
@@ -101,6 +143,1157 @@ namespace {
 
         sheet->ClearCell("B2"_pos);
         ASSERT_EQUAL(sheet->GetPrintableSize(), (Size{ 2, 1 }));
+
+        // ячейка с пустым текстом печатается как пустая
+        sheet->SetCell("A2"_pos, "");
+        std::ostringstream empty_texts;
+        sheet->PrintTexts(empty_texts);
+        ASSERT_EQUAL(empty_texts.str(), "=1/0\n\n");
+    }
+
+    void TestPrintLargeSheet() {
+        // числа форматируются так же, как потоком с его точностью и форматом,
+        // пустые блоки дают разделители
+        SheetImpl sheet;
+        const std::vector<std::string> formulas = { "=1/3", "=1e20", "=123456789", "=-0.5", "=1e-7", "=2/3*1e-300" };
+        const int rows = 150;
+        const int cols = 70;
+        auto is_set = [](int row, int col) {
+            return (row * 7 + col) % 5 == 0 && !(row > 64 && row < 128);
+        };
+        for (int row = 0; row < rows; ++row) {
+            for (int col = 0; col < cols; ++col) {
+                if (is_set(row, col)) {
+                    sheet.SetCell(Position{ row, col }, formulas[(row + col) % formulas.size()]);
+                }
+            }
+        }
+        sheet.SetCell(Position{ rows - 1, cols - 1 }, "'=text");
+        auto print_expected = [&](std::ostream& expected) {
+            for (int row = 0; row < rows; ++row) {
+                for (int col = 0; col < cols; ++col) {
+                    if (col > 0) {
+                        expected << '\t';
+                    }
+                    if (is_set(row, col)) {
+                        expected << std::get<double>(sheet.GetCell(Position{ row, col })->GetValue());
+                    }
+                }
+                expected << '\n';
+            }
+        };
+        std::ostringstream expected;
+        print_expected(expected);
+        std::string text = expected.str();
+        text.insert(text.size() - 1, "=text");
+
+        std::ostringstream values;
+        sheet.PrintValues(values);
+        ASSERT_EQUAL(values.str(), text);
+
+        // showpos и hexfloat to_chars не умеет, такие числа пишет сам поток
+        const std::vector<std::function<void(std::ostream&)>> formats = {
+            [](std::ostream& output) { output << std::setprecision(12); },
+            [](std::ostream& output) { output << std::fixed << std::setprecision(3); },
+            [](std::ostream& output) { output << std::scientific << std::setprecision(0); },
+            [](std::ostream& output) { output << std::showpos << std::setprecision(2); },
+            [](std::ostream& output) { output << std::hexfloat; },
+        };
+        for (const auto& format : formats) {
+            std::ostringstream formatted_expected;
+            format(formatted_expected);
+            print_expected(formatted_expected);
+            std::string formatted_text = formatted_expected.str();
+            formatted_text.insert(formatted_text.size() - 1, "=text");
+            std::ostringstream formatted;
+            format(formatted);
+            sheet.PrintValues(formatted);
+            ASSERT_EQUAL(formatted.str(), formatted_text);
+        }
+
+        std::FILE* file = std::tmpfile();
+        ASSERT(file != nullptr);
+        sheet.PrintValues(fileno(file));
+        std::rewind(file);
+        std::string from_fd(text.size() + 1, '\0');
+        from_fd.resize(std::fread(from_fd.data(), 1, from_fd.size(), file));
+        std::fclose(file);
+        ASSERT_EQUAL(from_fd, text);
+    }
+
+    void TestFormulaEvaluation() {
+        auto sheet = CreateSheet();
+        auto evaluate = [&](Position pos, std::string text) {
+            sheet->SetCell(pos, std::move(text));
+            return sheet->GetCell(pos)->GetValue();
+        };
+
+        ASSERT_EQUAL(evaluate("A1"_pos, "=1+2*3"), CellInterface::Value(7.0));
+        ASSERT_EQUAL(evaluate("A2"_pos, "=(1+2)*-3"), CellInterface::Value(-9.0));
+        ASSERT_EQUAL(evaluate("A3"_pos, "=8/2/2"), CellInterface::Value(2.0));
+        ASSERT_EQUAL(evaluate("A4"_pos, "=1-(2-3)"), CellInterface::Value(2.0));
+        ASSERT_EQUAL(evaluate("A5"_pos, "=1/0"), CellInterface::Value(FormulaError::Category::Arithmetic));
+
+        sheet->SetCell("B1"_pos, "12");
+        sheet->SetCell("B2"_pos, "text");
+        ASSERT_EQUAL(evaluate("C1"_pos, "=B1*B1+B1"), CellInterface::Value(156.0));
+        ASSERT_EQUAL(evaluate("C2"_pos, "=B1+B2"), CellInterface::Value(FormulaError::Category::Value));
+        ASSERT_EQUAL(evaluate("C3"_pos, "=1/0+B2"), CellInterface::Value(FormulaError::Category::Value));
+        ASSERT_EQUAL(evaluate("C4"_pos, "=A5+1"), CellInterface::Value(FormulaError::Category::Value));
+    }
+
+    void TestAggregateFunctions() {
+        auto sheet = CreateSheet();
+        auto evaluate = [&](Position pos, std::string text) {
+            sheet->SetCell(pos, std::move(text));
+            return sheet->GetCell(pos)->GetValue();
+        };
+        sheet->SetCell("A1"_pos, "1");
+        sheet->SetCell("A2"_pos, "2");
+        sheet->SetCell("A3"_pos, "3");
+        sheet->SetCell("A4"_pos, "text");
+        sheet->SetCell("B1"_pos, "=A1*10");
+
+        // пустые ячейки и нечисловой текст диапазона пропускаются
+        ASSERT_EQUAL(evaluate("D1"_pos, "=SUM(A1:B4)"), CellInterface::Value(16.0));
+        ASSERT_EQUAL(evaluate("D2"_pos, "=MIN(A1:B4)"), CellInterface::Value(1.0));
+        ASSERT_EQUAL(evaluate("D3"_pos, "=MAX(A1:B4)"), CellInterface::Value(10.0));
+        ASSERT_EQUAL(evaluate("D4"_pos, "=COUNT(A1:B4)"), CellInterface::Value(4.0));
+        ASSERT_EQUAL(evaluate("D5"_pos, "=AVERAGE(A1:B4)"), CellInterface::Value(4.0));
+        ASSERT_EQUAL(evaluate("D6"_pos, "=SUM(A1:A2,5,A1*2)+1"), CellInterface::Value(11.0));
+        ASSERT_EQUAL(evaluate("D7"_pos, "=-MAX(A1,SUM(A2:A3))*2"), CellInterface::Value(-10.0));
+        ASSERT_EQUAL(sheet->GetCell("D7"_pos)->GetText(), "=-MAX(A1,SUM(A2:A3))*2");
+        ASSERT_EQUAL(evaluate("D8"_pos, "=SUM(B4:A1)"), CellInterface::Value(16.0));
+        ASSERT_EQUAL(sheet->GetCell("D8"_pos)->GetText(), "=SUM(A1:B4)");
+
+        ASSERT_EQUAL(evaluate("E1"_pos, "=SUM(X10:Y20)"), CellInterface::Value(0.0));
+        ASSERT_EQUAL(evaluate("E2"_pos, "=MIN(X10:Y20)"), CellInterface::Value(0.0));
+        ASSERT_EQUAL(evaluate("E3"_pos, "=AVERAGE(X10:Y20)"), CellInterface::Value(FormulaError::Category::Arithmetic));
+        ASSERT(sheet->GetCell("X10"_pos) == nullptr);
+        ASSERT_EQUAL(evaluate("E4"_pos, "=SUM(A4)"), CellInterface::Value(FormulaError::Category::Value));
+        sheet->SetCell("B2"_pos, "=1/0");
+        ASSERT_EQUAL(sheet->GetCell("D1"_pos)->GetValue(), CellInterface::Value(FormulaError::Category::Value));
+        ASSERT_EQUAL(sheet->GetCell("D4"_pos)->GetValue(), CellInterface::Value(FormulaError::Category::Value));
+
+        for (const char* text : { "=A1:A2", "=SUM()", "=SUM(A1:)", "=SUM(A1:A2+1)", "=FOO(A1)", "=SUM A1",
+                                  "=SUM(A0:A2)", "=SUM(A1,)", "=(A1:A2)" }) {
+            bool caught = false;
+            try {
+                sheet->SetCell("F1"_pos, text);
+            }
+            catch (const FormulaException&) {
+                caught = true;
+            }
+            ASSERT(caught);
+        }
+
+        // длинный диапазон агрегируется в несколько потоков накопления
+        std::vector<std::pair<Position, std::string>> column;
+        for (int row = 0; row < 1001; ++row) {
+            column.emplace_back(Position{ row, 6 }, std::to_string(row));
+        }
+        sheet->SetCells(std::move(column));
+        ASSERT_EQUAL(evaluate("H1"_pos, "=SUM(G1:G1001)"), CellInterface::Value(500500.0));
+        ASSERT_EQUAL(evaluate("H2"_pos, "=MAX(G1:G1001)"), CellInterface::Value(1000.0));
+        ASSERT_EQUAL(evaluate("H3"_pos, "=AVERAGE(G1:G1001)"), CellInterface::Value(500.0));
+
+        // текст, целиком записывающий число, в диапазоне считается числом, в
+        // том числе экранированный
+        sheet->SetCell("I1"_pos, "'5");
+        sheet->SetCell("I2"_pos, "7");
+        sheet->SetCell("I3"_pos, "'x");
+        ASSERT_EQUAL(evaluate("J1"_pos, "=SUM(I1:I3)"), CellInterface::Value(12.0));
+        ASSERT_EQUAL(evaluate("J2"_pos, "=COUNT(I1:I3)"), CellInterface::Value(2.0));
+        ASSERT_EQUAL(evaluate("J3"_pos, "=MIN(I1:I3)"), CellInterface::Value(5.0));
+    }
+
+    void TestRangeRecalculation() {
+        SheetImpl sheet;
+        sheet.SetCell("C1"_pos, "=SUM(A1:A3)");
+        sheet.SetCell("D1"_pos, "=COUNT(C1:C2)+C1");
+        ASSERT_EQUAL(sheet.GetCell("D1"_pos)->GetValue(), CellInterface::Value(1.0));
+        // ячейки диапазона не создаются
+        ASSERT(sheet.GetCell("A2"_pos) == nullptr);
+        ASSERT_EQUAL(sheet.GetRangeIndex().GetSize(), 2u);
+
+        sheet.SetCell("A2"_pos, "5");
+        ASSERT_EQUAL(sheet.GetRecalcStats().invalidated, 2u);
+        ASSERT_EQUAL(sheet.GetCell("D1"_pos)->GetValue(), CellInterface::Value(6.0));
+        sheet.SetCell("A1"_pos, "=A2*2");
+        sheet.SetCell("A3"_pos, "7");
+        ASSERT_EQUAL(sheet.GetCell("C1"_pos)->GetValue(), CellInterface::Value(22.0));
+        sheet.ClearCell("A3"_pos);
+        ASSERT_EQUAL(sheet.GetCell("D1"_pos)->GetValue(), CellInterface::Value(16.0));
+        // A2 остается пустой ячейкой, на которую ссылается A1
+        sheet.ClearCell("A2"_pos);
+        ASSERT_EQUAL(sheet.GetCell("C1"_pos)->GetValue(), CellInterface::Value(0.0));
+
+        sheet.SetRecalcMode(Recalculator::Mode::Eager);
+        sheet.SetCell("A2"_pos, "1");
+        ASSERT_EQUAL(sheet.GetRecalcStats().recalculated, 3u);
+        ASSERT_EQUAL(sheet.GetCell("D1"_pos)->GetValue(), CellInterface::Value(4.0));
+
+        // после замены формулы ее диапазоны больше не отслеживаются
+        sheet.SetCell("C1"_pos, "=A2");
+        sheet.SetCell("D1"_pos, "text");
+        ASSERT_EQUAL(sheet.GetRangeIndex().GetSize(), 0u);
+        sheet.SetCell("A3"_pos, "1");
+        ASSERT_EQUAL(sheet.GetRecalcStats().invalidated, 0u);
+    }
+
+    // Ячейки листа для тестов индексов, где они нужны только как метки записей
+    std::vector<Cell*> MakeTagCells(SheetImpl& sheet, int count) {
+        std::vector<Cell*> cells;
+        for (int row = 0; row < count; ++row) {
+            sheet.SetCell(Position{ row, 0 }, "x");
+            cells.push_back(sheet.GetConcreteCell(Position{ row, 0 }));
+        }
+        return cells;
+    }
+
+    // Линейный конгруэнтный генератор: рандомизированные тесты повторяются
+    // от прогона к прогону
+    class TestRandom {
+    public:
+        explicit TestRandom(std::uint32_t seed) : seed_(seed) {}
+
+        // Число в [0, bound)
+        int operator()(int bound) {
+            seed_ = seed_ * 1664525u + 1013904223u;
+            return int((seed_ >> 8) % std::uint32_t(bound));
+        }
+
+    private:
+        std::uint32_t seed_;
+    };
+
+    void TestRangeIndex() {
+        SheetImpl sheet;
+        const std::vector<Cell*> cells = MakeTagCells(sheet, 500);
+        std::vector<std::pair<CellRange, Cell*>> entries;
+        TestRandom next(777);
+        RangeIndex index;
+        for (Cell* cell : cells) {
+            const Position from{ next(200), next(50) };
+            const CellRange range{ from, { from.row + next(20), from.col + next(5) } };
+            index.Insert(range, cell);
+            entries.emplace_back(range, cell);
+        }
+        auto check = [&] {
+            ASSERT_EQUAL(index.GetSize(), entries.size());
+            for (int i = 0; i < 300; ++i) {
+                const Position pos{ next(230), next(60) };
+                std::vector<Cell*> expected;
+                for (const auto& [range, cell] : entries) {
+                    if (range.Contains(pos)) {
+                        expected.push_back(cell);
+                    }
+                }
+                std::vector<Cell*> found;
+                index.ForEachContaining(pos, [&found](Cell* cell) {
+                    found.push_back(cell);
+                });
+                std::sort(expected.begin(), expected.end());
+                std::sort(found.begin(), found.end());
+                ASSERT(found == expected);
+            }
+        };
+        check();
+        std::vector<std::pair<CellRange, Cell*>> kept;
+        for (std::size_t i = 0; i < entries.size(); ++i) {
+            if (i % 2 == 0) {
+                index.Erase(entries[i].first, entries[i].second);
+            }
+            else {
+                kept.push_back(entries[i]);
+            }
+        }
+        entries = std::move(kept);
+        check();
+        for (const auto& [range, cell] : entries) {
+            index.Erase(range, cell);
+        }
+        entries.clear();
+        check();
+        index.Insert({ "A1"_pos, "B2"_pos }, cells[0]);
+        entries.emplace_back(CellRange{ "A1"_pos, "B2"_pos }, cells[0]);
+        check();
+    }
+
+    void TestPlaceholderIndex() {
+        SheetImpl sheet;
+        const std::vector<Cell*> cells = MakeTagCells(sheet, 8);
+        constexpr int SIDE = 40;
+        std::vector<std::vector<Cell*>> expected(SIDE * SIDE);
+        TestRandom next(777);
+        PlaceholderIndex index;
+        std::size_t size = 0;
+        for (int step = 0; step < 20000; ++step) {
+            const int key = next(SIDE * SIDE);
+            const Position pos{ key / SIDE, key % SIDE };
+            std::vector<Cell*>& list = expected[key];
+            const std::size_t old_size = list.size();
+            // вставки чаще удалений: таблица растет и переносит записи
+            const int action = next(step < 10000 ? 4 : 7);
+            if (action < 3) {
+                Cell* cell = cells[next(8)];
+                index.Insert(pos, cell);
+                if (std::find(list.begin(), list.end(), cell) == list.end()) {
+                    list.insert(std::lower_bound(list.begin(), list.end(), cell, std::less<Cell*>()), cell);
+                }
+            }
+            else if (action < 6) {
+                Cell* cell = cells[next(8)];
+                index.Erase(pos, cell);
+                list.erase(std::remove(list.begin(), list.end(), cell), list.end());
+            }
+            else {
+                ASSERT(index.Take(pos) == list);
+                list.clear();
+            }
+            size = size - (old_size > 0) + (!list.empty());
+            ASSERT_EQUAL(index.GetSize(), size);
+            if (step % 1000 == 0) {
+                for (int i = 0; i < SIDE * SIDE; ++i) {
+                    ASSERT(index.Get(Position{ i / SIDE, i % SIDE }) == expected[i]);
+                }
+            }
+        }
+        for (int i = 0; i < SIDE * SIDE; ++i) {
+            ASSERT(index.Get(Position{ i / SIDE, i % SIDE }) == expected[i]);
+        }
+    }
+
+    void TestRangeCircularDependency() {
+        auto sheet = CreateSheet();
+        auto is_circular = [&](Position pos, std::string text) {
+            try {
+                sheet->SetCell(pos, std::move(text));
+            }
+            catch (const CircularDependencyException&) {
+                return true;
+            }
+            return false;
+        };
+        ASSERT(is_circular("B3"_pos, "=SUM(A1:C3)"));
+        ASSERT(!is_circular("B2"_pos, "=SUM(A1:A3)"));
+        ASSERT(is_circular("A2"_pos, "=B2+1"));
+        ASSERT(!is_circular("C1"_pos, "=MAX(B1:B3)"));
+        ASSERT(is_circular("A3"_pos, "=C1"));
+        ASSERT(sheet->GetCell("A3"_pos) == nullptr);
+
+        try {
+            sheet->SetCells({ { "E5"_pos, "=SUM(F5:F6)" }, { "F6"_pos, "=E5" } });
+            ASSERT(false);
+        }
+        catch (const CircularDependencyException&) {
+        }
+        ASSERT(sheet->GetCell("E5"_pos) == nullptr);
+        sheet->SetCells({ { "E5"_pos, "=SUM(F5:F6)" }, { "F6"_pos, "=E6" } });
+        ASSERT_EQUAL(sheet->GetCell("E5"_pos)->GetValue(), CellInterface::Value(0.0));
+
+        // цикл внутри пакета и циклы, которые замыкает формула листа: через
+        // диапазон и через пустую позицию
+        sheet->SetCell("G5"_pos, "=SUM(G1:G2)");
+        sheet->SetCell("K1"_pos, "=L1");
+        for (const auto& cells : { std::vector<std::pair<Position, std::string>>{ { "Q1"_pos, "=P1" }, { "P1"_pos, "=Q1" } },
+                                   std::vector<std::pair<Position, std::string>>{ { "G2"_pos, "=H1" }, { "H1"_pos, "=G5" } },
+                                   std::vector<std::pair<Position, std::string>>{ { "M1"_pos, "=K1" }, { "L1"_pos, "=M1" } } }) {
+            try {
+                sheet->SetCells(cells);
+                ASSERT(false);
+            }
+            catch (const CircularDependencyException&) {
+            }
+        }
+        ASSERT(sheet->GetCell("P1"_pos) == nullptr);
+        ASSERT(sheet->GetCell("H1"_pos) == nullptr);
+        ASSERT(sheet->GetCell("L1"_pos) == nullptr);
+    }
+
+    void TestNumericText() {
+        auto sheet = CreateSheet();
+        auto value_of = [&](std::string text) {
+            sheet->SetCell("A1"_pos, std::move(text));
+            sheet->SetCell("B1"_pos, "=A1*2");
+            return sheet->GetCell("B1"_pos)->GetValue();
+        };
+        ASSERT_EQUAL(value_of("3.5"), CellInterface::Value(7.0));
+        ASSERT_EQUAL(value_of("007"), CellInterface::Value(14.0));
+        ASSERT_EQUAL(value_of("0"), CellInterface::Value(0.0));
+        ASSERT_EQUAL(value_of("-2"), CellInterface::Value(-4.0));
+        ASSERT_EQUAL(value_of("1e3"), CellInterface::Value(2000.0));
+        ASSERT_EQUAL(value_of("'5"), CellInterface::Value(10.0));
+        const CellInterface::Value error = FormulaError(FormulaError::Category::Value);
+        ASSERT_EQUAL(value_of("3.5x"), error);
+        ASSERT_EQUAL(value_of(" 1"), error);
+        ASSERT_EQUAL(value_of("+1"), error);
+        ASSERT_EQUAL(value_of("inf"), error);
+        ASSERT_EQUAL(value_of("1e999"), error);
+
+        // пустая ячейка, на которую ссылается формула, равна 0
+        sheet->ClearCell("A1"_pos);
+        ASSERT_EQUAL(sheet->GetCell("B1"_pos)->GetValue(), CellInterface::Value(0.0));
+        ASSERT(sheet->GetCell("A1"_pos) == nullptr);
+    }
+
+    void TestDeepFormula() {
+        auto sheet = CreateSheet();
+        const int depth = 1000;
+        std::string left_nested(depth - 1, '(');
+        left_nested += "1";
+        std::string right_nested;
+        for (int i = 2; i <= depth; ++i) {
+            left_nested += "+" + std::to_string(i) + ")";
+            right_nested += std::to_string(i - 1) + "+(";
+        }
+        right_nested += std::to_string(depth) + std::string(depth - 1, ')');
+
+        sheet->SetCell("A1"_pos, "=" + left_nested);
+        sheet->SetCell("A2"_pos, "=" + right_nested);
+        ASSERT_EQUAL(sheet->GetCell("A1"_pos)->GetValue(), CellInterface::Value(500500.0));
+        ASSERT_EQUAL(sheet->GetCell("A2"_pos)->GetValue(), CellInterface::Value(500500.0));
+    }
+
+    void TestSparseCells() {
+        auto sheet = CreateSheet();
+        sheet->SetCell("BL64"_pos, "edge");
+        sheet->SetCell("BM65"_pos, "next tile");
+        sheet->SetCell(Position{ Position::MAX_ROWS - 1, Position::MAX_COLS - 1 }, "corner");
+        ASSERT_EQUAL(sheet->GetPrintableSize(), (Size{ Position::MAX_ROWS, Position::MAX_COLS }));
+        ASSERT_EQUAL(sheet->GetCell("BL64"_pos)->GetText(), "edge");
+        ASSERT(sheet->GetCell("BM64"_pos) == nullptr);
+
+        sheet->ClearCell(Position{ Position::MAX_ROWS - 1, Position::MAX_COLS - 1 });
+        ASSERT_EQUAL(sheet->GetPrintableSize(), (Size{ 65, 65 }));
+        sheet->ClearCell("BM65"_pos);
+        ASSERT_EQUAL(sheet->GetPrintableSize(), (Size{ 64, 64 }));
+        ASSERT_EQUAL(sheet->GetCell("BL64"_pos)->GetText(), "edge");
+    }
+
+    void TestPrintableBounds() {
+        auto sheet = CreateSheet();
+        // границы по строкам и по столбцам задают разные ячейки
+        sheet->SetCell("A5000"_pos, "bottom");
+        sheet->SetCell("C5000"_pos, "bottom too");
+        sheet->SetCell("ZZ1"_pos, "right");
+        sheet->SetCell("B2"_pos, "inner");
+        ASSERT_EQUAL(sheet->GetPrintableSize(), (Size{ 5000, 702 }));
+
+        sheet->ClearCell("A5000"_pos);
+        ASSERT_EQUAL(sheet->GetPrintableSize(), (Size{ 5000, 702 }));
+        sheet->ClearCell("ZZ1"_pos);
+        ASSERT_EQUAL(sheet->GetPrintableSize(), (Size{ 5000, 3 }));
+        sheet->ClearCell("C5000"_pos);
+        ASSERT_EQUAL(sheet->GetPrintableSize(), (Size{ 2, 2 }));
+
+        // перезапись занятой ячейки не меняет счетчики
+        sheet->SetCell("B2"_pos, "=1+2");
+        sheet->SetCell("B2"_pos, "inner again");
+        ASSERT_EQUAL(sheet->GetPrintableSize(), (Size{ 2, 2 }));
+        sheet->ClearCell("B2"_pos);
+        ASSERT_EQUAL(sheet->GetPrintableSize(), (Size{ 0, 0 }));
+    }
+
+    void TestRecalculation() {
+        auto sheet = CreateSheet();
+        sheet->SetCell("A1"_pos, "1");
+        sheet->SetCell("A2"_pos, "=A1+1");
+        sheet->SetCell("A3"_pos, "=A2*10");
+        ASSERT_EQUAL(sheet->GetCell("A3"_pos)->GetValue(), CellInterface::Value(20.0));
+
+        sheet->SetCell("A1"_pos, "2");
+        ASSERT_EQUAL(sheet->GetCell("A3"_pos)->GetValue(), CellInterface::Value(30.0));
+        sheet->SetCell("A2"_pos, "=A1*A1");
+        ASSERT_EQUAL(sheet->GetCell("A3"_pos)->GetValue(), CellInterface::Value(40.0));
+        sheet->SetCell("A2"_pos, "5");
+        ASSERT_EQUAL(sheet->GetCell("A3"_pos)->GetValue(), CellInterface::Value(50.0));
+        sheet->SetCell("A1"_pos, "7");
+        ASSERT_EQUAL(sheet->GetCell("A3"_pos)->GetValue(), CellInterface::Value(50.0));
+
+        sheet->ClearCell("A2"_pos);
+        ASSERT(sheet->GetCell("A2"_pos) == nullptr);
+        ASSERT_EQUAL(sheet->GetCell("A3"_pos)->GetValue(), CellInterface::Value(0.0));
+
+        sheet->SetCell("B1"_pos, "=1");
+        sheet->SetCell("C1"_pos, "=B1+1");
+        sheet->SetCell("D1"_pos, "=B1+C1");
+        ASSERT_EQUAL(sheet->GetCell("D1"_pos)->GetValue(), CellInterface::Value(3.0));
+    }
+
+    void TestRecalcStats() {
+        SheetImpl sheet;
+        sheet.SetCell("A1"_pos, "1");
+        sheet.SetCell("B1"_pos, "=A1+1");
+        sheet.SetCell("B2"_pos, "=A1+2");
+        sheet.SetCell("C1"_pos, "=B1+B2");
+        sheet.SetCell("D1"_pos, "=C1");
+        sheet.SetCell("Z1"_pos, "=1");
+        ASSERT_EQUAL(std::get<double>(sheet.GetCell("D1"_pos)->GetValue()), 5.0);
+
+        sheet.SetCell("A1"_pos, "2");
+        ASSERT_EQUAL(sheet.GetRecalcStats().invalidated, 4u);
+        ASSERT_EQUAL(sheet.GetRecalcStats().recalculated, 0u);
+        ASSERT_EQUAL(std::get<double>(sheet.GetCell("C1"_pos)->GetValue()), 7.0);
+        ASSERT_EQUAL(sheet.GetRecalcStats().recalculated, 3u);
+
+        sheet.SetRecalcMode(Recalculator::Mode::Eager);
+        sheet.SetCell("B2"_pos, "=A1+3");
+        ASSERT_EQUAL(sheet.GetRecalcStats().invalidated, 2u);
+        ASSERT_EQUAL(sheet.GetRecalcStats().recalculated, 3u);
+        ASSERT_EQUAL(std::get<double>(sheet.GetCell("D1"_pos)->GetValue()), 8.0);
+        ASSERT_EQUAL(sheet.GetRecalcStats().recalculated, 3u);
+    }
+
+    void TestLongDependencyChain() {
+        auto sheet = CreateSheet();
+        const int length = Position::MAX_ROWS;
+        for (int row = length - 1; row > 0; --row) {
+            sheet->SetCell(Position{ row, 0 }, "=" + Position{ row - 1, 0 }.ToString() + "+1");
+        }
+        sheet->SetCell("A1"_pos, "1");
+        ASSERT_EQUAL(sheet->GetCell(Position{ length - 1, 0 })->GetValue(), CellInterface::Value(double(length)));
+        sheet->SetCell("A1"_pos, "2");
+        ASSERT_EQUAL(sheet->GetCell(Position{ length - 1, 0 })->GetValue(), CellInterface::Value(double(length + 1)));
+    }
+
+    void TestParallelRecalculation() {
+        const int rows = 200;
+        const int cols = 8;
+        auto fill = [&](SheetImpl& sheet) {
+            for (int col = 0; col < cols; ++col) {
+                sheet.SetCell(Position{ 0, col }, std::to_string(col + 1));
+            }
+            for (int row = 1; row < rows; ++row) {
+                for (int col = 0; col < cols; ++col) {
+                    const Position left{ row - 1, (col + cols - 1) % cols };
+                    const Position up{ row - 1, col };
+                    sheet.SetCell(Position{ row, col }, "=" + up.ToString() + "*0.5+" + left.ToString() + "/3");
+                }
+            }
+        };
+
+        SheetImpl sequential;
+        SheetImpl parallel;
+        fill(sequential);
+        fill(parallel);
+        parallel.SetRecalcThreadCount(4);
+        sequential.RecalculateAll();
+        parallel.RecalculateAll();
+        ASSERT_EQUAL(parallel.GetRecalcStats().recalculated, std::size_t((rows - 1) * cols));
+
+        parallel.SetRecalcMode(Recalculator::Mode::Eager);
+        sequential.SetCell("A1"_pos, "100");
+        parallel.SetCell("A1"_pos, "100");
+        for (int row = 0; row < rows; ++row) {
+            for (int col = 0; col < cols; ++col) {
+                const Position pos{ row, col };
+                ASSERT_EQUAL(sequential.GetCell(pos)->GetValue(), parallel.GetCell(pos)->GetValue());
+            }
+        }
+    }
+
+    void TestCircularDependency() {
+        auto sheet = CreateSheet();
+        sheet->SetCell("A1"_pos, "=B1+1");
+        sheet->SetCell("B1"_pos, "=C1*2");
+        bool caught = false;
+        try {
+            sheet->SetCell("C1"_pos, "=A1");
+        }
+        catch (const CircularDependencyException&) {
+            caught = true;
+        }
+        ASSERT(caught);
+        ASSERT(sheet->GetCell("C1"_pos) == nullptr);
+
+        sheet->SetCell("C1"_pos, "=D1+D2");
+        caught = false;
+        try {
+            sheet->SetCell("D2"_pos, "=1+B1");
+        }
+        catch (const CircularDependencyException&) {
+            caught = true;
+        }
+        ASSERT(caught);
+        ASSERT(sheet->GetCell("D2"_pos) == nullptr);
+        sheet->SetCell("D2"_pos, "=D1");
+        sheet->SetCell("D1"_pos, "1");
+        ASSERT_EQUAL(sheet->GetCell("A1"_pos)->GetValue(), CellInterface::Value(5.0));
+    }
+
+    void TestLongCircularDependency() {
+        auto sheet = CreateSheet();
+        const int length = Position::MAX_ROWS;
+        for (int row = length - 1; row > 0; --row) {
+            sheet->SetCell(Position{ row, 0 }, "=" + Position{ row - 1, 0 }.ToString() + "+1");
+        }
+        bool caught = false;
+        try {
+            sheet->SetCell("A1"_pos, "=" + Position{ length - 1, 0 }.ToString());
+        }
+        catch (const CircularDependencyException&) {
+            caught = true;
+        }
+        ASSERT(caught);
+        sheet->SetCell("A1"_pos, "=0");
+        ASSERT_EQUAL(sheet->GetCell(Position{ length - 1, 0 })->GetValue(), CellInterface::Value(double(length - 1)));
+    }
+
+    void TestSelfReference() {
+        auto sheet = CreateSheet();
+        auto expect_circular = [&](Position pos, std::string text) {
+            try {
+                sheet->SetCell(pos, std::move(text));
+            }
+            catch (const CircularDependencyException&) {
+                return;
+            }
+            ASSERT(false);
+        };
+
+        expect_circular("A1"_pos, "=A1");
+        expect_circular("A1"_pos, "=B1+A1*2");
+        expect_circular("C7"_pos, "=(1+C7)");
+        ASSERT(sheet->GetCell("A1"_pos) == nullptr || sheet->GetCell("A1"_pos)->GetText().empty());
+
+        sheet->SetCell("A1"_pos, "A1 is a text");
+        ASSERT_EQUAL(sheet->GetCell("A1"_pos)->GetText(), "A1 is a text");
+        sheet->SetCell("A1"_pos, "'=A1");
+        ASSERT_EQUAL(sheet->GetCell("A1"_pos)->GetValue(), CellInterface::Value("=A1"));
+        sheet->SetCell("B2"_pos, "see B2");
+        ASSERT_EQUAL(sheet->GetCell("B2"_pos)->GetText(), "see B2");
+    }
+
+    void TestReferenceToSimilarName() {
+        auto sheet = CreateSheet();
+        sheet->SetCell("AA1"_pos, "3");
+        sheet->SetCell("A1"_pos, "=AA1+1");
+        ASSERT_EQUAL(sheet->GetCell("A1"_pos)->GetValue(), CellInterface::Value(4.0));
+
+        sheet->SetCell("A11"_pos, "5");
+        sheet->SetCell("A1"_pos, "=A11*2");
+        ASSERT_EQUAL(sheet->GetCell("A1"_pos)->GetValue(), CellInterface::Value(10.0));
+
+        sheet->SetCell("B1"_pos, "=BA1+AB1+B10+B11");
+        ASSERT_EQUAL(sheet->GetCell("B1"_pos)->GetText(), "=BA1+AB1+B10+B11");
+        sheet->SetCell("A2"_pos, "=AA1/A11");
+        ASSERT_EQUAL(sheet->GetCell("A2"_pos)->GetValue(), CellInterface::Value(0.6));
+    }
+
+    void TestUpReferencesRemoval() {
+        SheetImpl sheet;
+        sheet.SetCell("A1"_pos, "1");
+        sheet.SetCell("B1"_pos, "=A1+1");
+        sheet.SetCell("B2"_pos, "=A1+2");
+        ASSERT_EQUAL(sheet.GetConcreteCell("A1"_pos)->GetUpReferenceCells().size(), 2u);
+
+        sheet.SetCell("B1"_pos, "5");
+        ASSERT_EQUAL(sheet.GetConcreteCell("A1"_pos)->GetUpReferenceCells().size(), 1u);
+        sheet.ClearCell("B2"_pos);
+        ASSERT(sheet.GetConcreteCell("A1"_pos)->GetUpReferenceCells().empty());
+
+        sheet.SetCell("A1"_pos, "2");
+        ASSERT_EQUAL(sheet.GetRecalcStats().invalidated, 0u);
+
+        sheet.SetCell("C1"_pos, "=D1");
+        sheet.SetCell("C1"_pos, "=1");
+        ASSERT(sheet.GetCell("D1"_pos) == nullptr);
+    }
+
+    void TestMemoryReport() {
+        SheetImpl sheet;
+        sheet.SetCell("A1"_pos, "1");
+        sheet.SetCell("A2"_pos, "short text");
+        sheet.SetCell("A3"_pos, std::string(100, 'x'));
+        sheet.SetCell("B1"_pos, "=A1+C1");
+        sheet.SetCell("B2"_pos, "=1+2");
+
+        const SheetImpl::MemoryReport report = sheet.GetMemoryReport();
+        ASSERT_EQUAL(report.text.count, 3u);
+        ASSERT_EQUAL(report.formula.count, 2u);
+        // C1 существует только как цель ссылки: ячейка не создается
+        ASSERT_EQUAL(report.empty.count, 0u);
+        ASSERT_EQUAL(report.placeholders.count, 1u);
+        ASSERT(report.placeholders.heap_bytes > 0u);
+        ASSERT_EQUAL(report.text.cell_bytes, 3 * sizeof(Cell));
+
+        // числа и короткий текст не занимают памяти вне ячейки, связи есть
+        // только у ячеек графа зависимостей
+        ASSERT_EQUAL(sheet.GetConcreteCell("A2"_pos)->GetHeapSize(), 0u);
+        ASSERT_EQUAL(sheet.GetConcreteCell("A3"_pos)->GetHeapSize(), 100u);
+        ASSERT(sheet.GetConcreteCell("A1"_pos)->GetHeapSize() > 0u);
+        ASSERT(sheet.GetConcreteCell("B1"_pos)->GetHeapSize() > 0u);
+        ASSERT_EQUAL(sheet.GetConcreteCell("B2"_pos)->GetHeapSize(), 0u);
+
+        sheet.ClearCell("B1"_pos);
+        ASSERT_EQUAL(sheet.GetConcreteCell("A1"_pos)->GetHeapSize(), 0u);
+        ASSERT_EQUAL(sheet.GetMemoryReport().placeholders.count, 0u);
+
+        // до 15 символов текст лежит в ячейке, длиннее - в куче ровно по длине
+        const std::string inline_text(15, 'y');
+        const std::string heap_text(16, 'z');
+        sheet.SetCell("C1"_pos, inline_text);
+        sheet.SetCell("C2"_pos, heap_text);
+        ASSERT_EQUAL(sheet.GetConcreteCell("C1"_pos)->GetHeapSize(), 0u);
+        ASSERT_EQUAL(sheet.GetConcreteCell("C2"_pos)->GetHeapSize(), 16u);
+        ASSERT_EQUAL(sheet.GetCell("C1"_pos)->GetText(), inline_text);
+        ASSERT_EQUAL(sheet.GetCell("C2"_pos)->GetText(), heap_text);
+        sheet.SetCell("C2"_pos, "=C3*2");
+        sheet.SetCell("C3"_pos, "'=escaped long text");
+        ASSERT_EQUAL(sheet.GetCell("C3"_pos)->GetValue(), CellInterface::Value(std::string("=escaped long text")));
+        ASSERT_EQUAL(sheet.GetCell("C2"_pos)->GetValue(), CellInterface::Value(FormulaError(FormulaError::Category::Value)));
+        sheet.SetCell("C3"_pos, "21");
+        ASSERT_EQUAL(sheet.GetCell("C2"_pos)->GetValue(), CellInterface::Value(42.0));
+    }
+
+    void TestPlaceholders() {
+        SheetImpl sheet;
+        // ссылка на далекую пустую позицию не создает ячейку и не расширяет лист
+        sheet.SetCell("A1"_pos, "=ZZ9999+1");
+        ASSERT(sheet.GetCell("ZZ9999"_pos) == nullptr);
+        ASSERT_EQUAL(sheet.GetPrintableSize(), (Size{ 1, 1 }));
+        ASSERT_EQUAL(sheet.GetCell("A1"_pos)->GetValue(), CellInterface::Value(1.0));
+        ASSERT_EQUAL(sheet.GetPlaceholderIndex().Get("ZZ9999"_pos).size(), 1u);
+
+        // ячейка в позиции забирает ссылки из индекса
+        sheet.SetCell("ZZ9999"_pos, "2");
+        ASSERT_EQUAL(sheet.GetCell("A1"_pos)->GetValue(), CellInterface::Value(3.0));
+        ASSERT_EQUAL(sheet.GetPlaceholderIndex().GetSize(), 0u);
+        ASSERT_EQUAL(sheet.GetConcreteCell("ZZ9999"_pos)->GetUpReferenceCells().size(), 1u);
+
+        // при очистке ссылки возвращаются в индекс, зависимые сбрасываются
+        sheet.ClearCell("ZZ9999"_pos);
+        ASSERT(sheet.GetCell("ZZ9999"_pos) == nullptr);
+        ASSERT_EQUAL(sheet.GetPrintableSize(), (Size{ 1, 1 }));
+        ASSERT_EQUAL(sheet.GetCell("A1"_pos)->GetValue(), CellInterface::Value(1.0));
+        sheet.SetCell("ZZ9999"_pos, "4");
+        ASSERT_EQUAL(sheet.GetCell("A1"_pos)->GetValue(), CellInterface::Value(5.0));
+        sheet.ClearCell("ZZ9999"_pos);
+
+        // то же при записи пакетом, в том числе вместе со ссылающейся формулой
+        sheet.SetCells({ { "B1"_pos, "=ZZ9999*10" }, { "ZZ9999"_pos, "3" } });
+        ASSERT_EQUAL(sheet.GetCell("A1"_pos)->GetValue(), CellInterface::Value(4.0));
+        ASSERT_EQUAL(sheet.GetCell("B1"_pos)->GetValue(), CellInterface::Value(30.0));
+        ASSERT_EQUAL(sheet.GetConcreteCell("ZZ9999"_pos)->GetUpReferenceCells().size(), 2u);
+
+        // формула, переставшая ссылаться, удаляет ссылку из индекса
+        sheet.ClearCell("ZZ9999"_pos);
+        sheet.SetCells({ { "A1"_pos, "=1" }, { "B1"_pos, "text" } });
+        ASSERT_EQUAL(sheet.GetPlaceholderIndex().GetSize(), 0u);
+        ASSERT_EQUAL(sheet.GetPrintableSize(), (Size{ 1, 2 }));
+        ASSERT_EQUAL(sheet.GetMemoryReport().placeholders.count, 0u);
+    }
+
+    void TestSetCells() {
+        auto sheet = CreateSheet();
+        sheet->SetCell("A1"_pos, "1");
+        sheet->SetCell("B2"_pos, "=A1+10");
+        sheet->SetCells({
+            { "C1"_pos, "=B1*2" },
+            { "B1"_pos, "=A1+1" },
+            { "A1"_pos, "5" },
+            { "A1"_pos, "3" },
+            { "D1"_pos, "text" },
+        });
+        ASSERT_EQUAL(sheet->GetCell("A1"_pos)->GetText(), "3");
+        ASSERT_EQUAL(sheet->GetCell("C1"_pos)->GetValue(), CellInterface::Value(8.0));
+        ASSERT_EQUAL(sheet->GetCell("B2"_pos)->GetValue(), CellInterface::Value(13.0));
+        ASSERT_EQUAL(sheet->GetCell("D1"_pos)->GetText(), "text");
+
+        // старые ссылки снимаются, пустые ячейки без ссылок удаляются
+        sheet->SetCell("E1"_pos, "=F1");
+        sheet->SetCells({ { "E1"_pos, "=A1" }, { "C1"_pos, "=B1" } });
+        ASSERT(sheet->GetCell("F1"_pos) == nullptr);
+        ASSERT_EQUAL(sheet->GetCell("C1"_pos)->GetValue(), CellInterface::Value(4.0));
+        sheet->SetCell("A1"_pos, "10");
+        ASSERT_EQUAL(sheet->GetCell("E1"_pos)->GetValue(), CellInterface::Value(10.0));
+    }
+
+    // Дерево формулы в виде строки или "error", если разбор не удался
+    std::string ParseWith(const std::string& expression, FormulaParserKind kind) {
+        try {
+            FormulaAST ast = ParseFormulaAST(expression, kind);
+            std::ostringstream out;
+            ast.Print(out);
+            out << " | ";
+            ast.PrintCells(out);
+            return out.str();
+        }
+        catch (...) {
+            return "error";
+        }
+    }
+
+    void TestPrattParserMatchesAntlr() {
+        std::vector<std::string> expressions = {
+            "1", "A1", " ( 1 ) ", "1+2*3", "(1+2)*3", "1-2-3", "8/4/2", "-1*2", "--+1", "-(1+2)/A1",
+            "1.5e3+.5-2E-2", "1e+5", "ZZZ99+XFD16384", "A1+A1*B2", "1\t+\n2\r",
+            "", " ", "1+", "+", "(1", "1)", "()", "1 2", "A1B2", "a1", "A", "1.", "1..2", ".",
+            "1e", "1E5.5", "1.2.3", "0x10", "A0", "XFE1", "A16385", "A99999999999", "1e999", "1=2", "1%",
+            "SUM(A1:B2)", "SUM(B2:A1,1,-C3)", "AVERAGE ( A1 : A1 ) * 2", "COUNT(MIN(1),MAX(A1,A2:A3))", "SUMA1",
+            "SUM", "SUM()", "SUM(1,)", "SUM(A1:)", "SUM(A1:1)", "SUM(A1+A2:A3)", "A1:A2", "SUMX(1)", "sum(1)",
+            "SUM(A0:A1)", "MINMAX(1)", "SUM((A1:A2))",
+        };
+        // случайные строки из лексем грамматики: разбор либо совпадает, либо оба падают
+        const std::vector<std::string> alphabet = { "A", "Z", "1", "9", ".", "e", "E", "+", "-", "*", "/", "(", ")",
+                                                    " ", ":", ",", "SUM(", "MAX" };
+        std::uint32_t seed = 12345;
+        for (int i = 0; i < 5000; ++i) {
+            std::string expression;
+            const int length = 1 + i % 12;
+            for (int j = 0; j < length; ++j) {
+                seed = seed * 1664525u + 1013904223u;
+                expression += alphabet[(seed >> 16) % alphabet.size()];
+            }
+            expressions.push_back(std::move(expression));
+        }
+
+        int parsed = 0;
+        for (const std::string& expression : expressions) {
+            const std::string expected = ParseWith(expression, FormulaParserKind::Antlr);
+            ASSERT_EQUAL(ParseWith(expression, FormulaParserKind::Pratt), expected);
+            parsed += expected != "error";
+        }
+        ASSERT(parsed > 100);
+        ASSERT_EQUAL(ParseWith("-1*2", FormulaParserKind::Pratt), std::string("(* (- 1) 2) | "));
+        ASSERT_EQUAL(ParseWith("1-2-3", FormulaParserKind::Pratt), std::string("(- (- 1 2) 3) | "));
+
+        // разбор чисел не зависит от локали процесса (проверяется, если
+        // локаль с десятичной запятой установлена)
+        for (const char* name : { "de_DE.UTF-8", "ru_RU.UTF-8", "fr_FR.UTF-8" }) {
+            if (std::setlocale(LC_NUMERIC, name) != nullptr) {
+                const std::string parsed_number = ParseWith("1.5", FormulaParserKind::Pratt);
+                std::setlocale(LC_NUMERIC, "C");
+                ASSERT_EQUAL(parsed_number, std::string("1.5 | "));
+            }
+        }
+    }
+
+    void TestFormulaInterning() {
+        SheetImpl sheet;
+        for (int row = 0; row < 100; ++row) {
+            const std::string index = std::to_string(row + 1);
+            sheet.SetCell(Position{ row, 0 }, index);
+            sheet.SetCell(Position{ row, 1 }, "2");
+            sheet.SetCell(Position{ row, 2 }, "=A" + index + "*B" + index);
+        }
+        ASSERT_EQUAL(sheet.GetFormulaCache().GetSize(), 1u);
+        ASSERT_EQUAL(sheet.GetCell("C50"_pos)->GetText(), "=A50*B50");
+        ASSERT_EQUAL(sheet.GetCell("C50"_pos)->GetValue(), CellInterface::Value(100.0));
+        ASSERT_EQUAL(sheet.GetConcreteCell("C50"_pos)->GetReferencedCells(),
+                     std::vector<Position>({ "A50"_pos, "B50"_pos }));
+
+        // та же форма в другом столбце и с отрицательным сдвигом строк
+        sheet.SetCell("D2"_pos, "=B2*C2");
+        sheet.SetCell("E5"_pos, "=C4+1E2");
+        sheet.SetCell("E6"_pos, "=C5+1E2");
+        ASSERT_EQUAL(sheet.GetFormulaCache().GetSize(), 2u);
+        ASSERT_EQUAL(sheet.GetCell("D2"_pos)->GetValue(), CellInterface::Value(8.0));
+        ASSERT_EQUAL(sheet.GetCell("E6"_pos)->GetText(), "=C5+100");
+        ASSERT_EQUAL(sheet.GetCell("E6"_pos)->GetValue(), CellInterface::Value(110.0));
+
+        // диапазоны сдвигаются вместе со ссылками
+        sheet.SetCell("F1"_pos, "=SUM(A1:B3)");
+        sheet.SetCell("F2"_pos, "=SUM(A2:B4)");
+        ASSERT_EQUAL(sheet.GetFormulaCache().GetSize(), 3u);
+        ASSERT_EQUAL(sheet.GetCell("F2"_pos)->GetText(), "=SUM(A2:B4)");
+        ASSERT_EQUAL(sheet.GetCell("F2"_pos)->GetValue(), CellInterface::Value(15.0));
+        ASSERT(sheet.GetConcreteCell("F2"_pos)->GetReferencedRanges()
+               == std::vector<CellRange>({ { "A2"_pos, "B4"_pos } }));
+        sheet.ClearCell("F1"_pos);
+        sheet.ClearCell("F2"_pos);
+
+        // формы без ячеек больше не хранятся
+        for (int row = 0; row < 100; ++row) {
+            sheet.ClearCell(Position{ row, 2 });
+        }
+        sheet.ClearCell("D2"_pos);
+        ASSERT_EQUAL(sheet.GetFormulaCache().GetSize(), 1u);
+
+        // формула вне кэша хранит каноническую запись без дерева разбора
+        std::unique_ptr<FormulaInterface> formula = ParseFormula("(A1 + 2) * SUM(B2:C3)");
+        ASSERT_EQUAL(formula->GetExpression(), "(A1+2)*SUM(B2:C3)");
+        ASSERT_EQUAL(formula->GetReferencedCells(), std::vector<Position>({ "A1"_pos }));
+    }
+
+    void TestSetCellsIsAtomic() {
+        auto sheet = CreateSheet();
+        sheet->SetCell("A1"_pos, "1");
+        sheet->SetCell("B1"_pos, "=A1");
+
+        try {
+            sheet->SetCells({ { "C1"_pos, "2" }, { "A1"_pos, "=C2" }, { "C2"_pos, "=B1" } });
+            ASSERT(false);
+        }
+        catch (const CircularDependencyException&) {
+        }
+        try {
+            sheet->SetCells({ { "C1"_pos, "2" }, { "A1"_pos, "=1+" } });
+            ASSERT(false);
+        }
+        catch (const FormulaException&) {
+        }
+        try {
+            sheet->SetCells({ { "C1"_pos, "2" }, { Position{ -1, 0 }, "1" } });
+            ASSERT(false);
+        }
+        catch (const InvalidPositionException&) {
+        }
+        ASSERT(sheet->GetCell("C1"_pos) == nullptr);
+        ASSERT(sheet->GetCell("C2"_pos) == nullptr);
+        ASSERT_EQUAL(sheet->GetCell("A1"_pos)->GetText(), "1");
+        ASSERT_EQUAL(sheet->GetCell("B1"_pos)->GetValue(), CellInterface::Value(1.0));
+    }
+
+    std::string PrintSheet(const SheetImpl& sheet, bool is_print_value) {
+        std::ostringstream output;
+        if (is_print_value) {
+            sheet.PrintValues(output);
+        }
+        else {
+            sheet.PrintTexts(output);
+        }
+        return output.str();
+    }
+
+    void TestSnapshot() {
+        const std::string path = "spreadsheet_test_snapshot.bin";
+        SheetImpl sheet;
+        sheet.SetCell("A1"_pos, "2");
+        sheet.SetCell("A2"_pos, "'=escaped");
+        sheet.SetCell("A3"_pos, "text");
+        for (int row = 0; row < 50; ++row) {
+            sheet.SetCell(Position{ row, 1 }, std::to_string(row));
+            sheet.SetCell(Position{ row, 2 }, "=B" + std::to_string(row + 1) + "*A1");
+        }
+        sheet.SetCell("D1"_pos, "=SUM(B1:B50)+Z100");
+        sheet.SetCell("D2"_pos, "=1/0");
+        sheet.SetCell("D3"_pos, "=A3+1");
+        sheet.SetCell("D4"_pos, "=MAX(C1:C50, D1)");
+        ASSERT_EQUAL(sheet.GetCell("D1"_pos)->GetValue(), CellInterface::Value(1225.0));
+        ASSERT_EQUAL(sheet.GetCell("D2"_pos)->GetValue(), CellInterface::Value(FormulaError(FormulaError::Category::Arithmetic)));
+        ASSERT_EQUAL(sheet.GetCell("D3"_pos)->GetValue(), CellInterface::Value(FormulaError(FormulaError::Category::Value)));
+        // D4 остается невычисленной и в снимке
+        sheet.SaveSnapshot(path);
+
+        std::unique_ptr<SheetImpl> loaded = SheetImpl::LoadSnapshot(path);
+        std::remove(path.c_str());
+        ASSERT(loaded->GetPrintableSize() == sheet.GetPrintableSize());
+        ASSERT_EQUAL(PrintSheet(*loaded, false), PrintSheet(sheet, false));
+        ASSERT(loaded->GetConcreteCell("D1"_pos)->GetCachedValue().has_value());
+        ASSERT(!loaded->GetConcreteCell("D4"_pos)->GetCachedValue().has_value());
+        ASSERT_EQUAL(PrintSheet(*loaded, true), PrintSheet(sheet, true));
+        ASSERT_EQUAL(loaded->GetFormulaCache().GetSize(), sheet.GetFormulaCache().GetSize());
+
+        // граф зависимостей восстановлен: изменения доходят до формул
+        loaded->SetCell("A1"_pos, "3");
+        ASSERT_EQUAL(loaded->GetCell("C50"_pos)->GetValue(), CellInterface::Value(147.0));
+        ASSERT_EQUAL(loaded->GetCell("D4"_pos)->GetValue(), CellInterface::Value(1225.0));
+        loaded->SetCell("B50"_pos, "0");
+        ASSERT_EQUAL(loaded->GetCell("D1"_pos)->GetValue(), CellInterface::Value(1176.0));
+        loaded->SetCell("Z100"_pos, "1");
+        ASSERT_EQUAL(loaded->GetCell("D1"_pos)->GetValue(), CellInterface::Value(1177.0));
+        bool caught = false;
+        try {
+            loaded->SetCell("B1"_pos, "=D4");
+        }
+        catch (const CircularDependencyException&) {
+            caught = true;
+        }
+        ASSERT(caught);
+
+        // пустой лист
+        SheetImpl empty;
+        empty.SaveSnapshot(path);
+        ASSERT(SheetImpl::LoadSnapshot(path)->GetPrintableSize() == (Size{ 0, 0 }));
+
+        // ячейка, записанная пустой строкой, остается в печатной области
+        SheetImpl with_empty;
+        with_empty.SetCell("A1"_pos, "1");
+        with_empty.SetCell("C3"_pos, "x");
+        with_empty.SetCell("C3"_pos, "");
+        with_empty.SaveSnapshot(path);
+        loaded = SheetImpl::LoadSnapshot(path);
+        ASSERT_EQUAL(loaded->GetPrintableSize(), (Size{ 3, 3 }));
+        ASSERT(loaded->GetCell("C3"_pos) != nullptr);
+        ASSERT_EQUAL(loaded->GetCell("C3"_pos)->GetText(), "");
+        ASSERT_EQUAL(PrintSheet(*loaded, false), PrintSheet(with_empty, false));
+        std::remove(path.c_str());
+    }
+
+    void TestSnapshotCorruption() {
+        const std::string path = "spreadsheet_test_snapshot.bin";
+        SheetImpl sheet;
+        sheet.SetCell("A1"_pos, "1");
+        sheet.SetCell("B1"_pos, "=A1+SUM(A1:A5)");
+        sheet.SaveSnapshot(path);
+        std::string data;
+        {
+            std::ifstream input(path, std::ios::binary);
+            data.assign(std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>());
+        }
+        auto is_rejected = [&path](const std::string& content) {
+            {
+                std::ofstream output(path, std::ios::binary | std::ios::trunc);
+                output.write(content.data(), content.size());
+            }
+            try {
+                SheetImpl::LoadSnapshot(path);
+            }
+            catch (const SnapshotException&) {
+                return true;
+            }
+            return false;
+        };
+        ASSERT(!is_rejected(data));
+        // любой измененный байт ловится контрольной суммой или проверкой заголовка
+        for (std::size_t i = 0; i < data.size(); ++i) {
+            std::string corrupted = data;
+            corrupted[i] ^= 0x10;
+            ASSERT(is_rejected(corrupted));
+        }
+        ASSERT(is_rejected(data.substr(0, data.size() - 1)));
+        ASSERT(is_rejected(""));
+
+        // снимок с верными суммами, но с циклом, которого не допустил бы лист
+        FormulaCache cache;
+        auto write_formulas = [&cache, &path](const std::vector<std::pair<Position, std::string>>& cells) {
+            SnapshotWriter writer;
+            std::vector<std::unique_ptr<FormulaInterface>> formulas;
+            for (const auto& [pos, expression] : cells) {
+                if (expression[0] == '=') {
+                    writer.AddText(pos, expression);
+                    continue;
+                }
+                formulas.push_back(cache.Parse(expression, pos));
+                writer.AddFormula(pos, FormulaCache::GetTemplate(*formulas.back()), std::nullopt);
+            }
+            writer.Save(path);
+        };
+        auto is_circular = [&path]() {
+            try {
+                SheetImpl::LoadSnapshot(path);
+            }
+            catch (const SnapshotException& e) {
+                return std::string(e.what()).find("circular") != std::string::npos;
+            }
+            return false;
+        };
+        write_formulas({ { "A1"_pos, "B1" }, { "B1"_pos, "A1" } });
+        ASSERT(is_circular());
+        write_formulas({ { "A1"_pos, "A1+1" } });
+        ASSERT(is_circular());
+        write_formulas({ { "A1"_pos, "SUM(B1:B3)" }, { "B2"_pos, "C5*2" }, { "C5"_pos, "=A1" } });
+        ASSERT(is_circular());
+        write_formulas({ { "A1"_pos, "SUM(B1:B3)" }, { "B2"_pos, "C5*2" }, { "C5"_pos, "=D1" } });
+        ASSERT(!is_circular());
+
+        // число обратных ссылок больше числа ячеек не выделяется, а отвергается
+        {
+            SnapshotWriter writer;
+            writer.AddText("A1"_pos, "1", 1000000000u);
+            writer.Save(path);
+        }
+        bool is_count_rejected = false;
+        try {
+            SheetImpl::LoadSnapshot(path);
+        }
+        catch (const SnapshotException&) {
+            is_count_rejected = true;
+        }
+        ASSERT(is_count_rejected);
+        std::remove(path.c_str());
+
+        bool caught = false;
+        try {
+            SheetImpl::LoadSnapshot(path);
+        }
+        catch (const SnapshotException&) {
+            caught = true;
+        }
+        ASSERT(caught);
+    }
+
+    void TestTsvReader() {
+        // маленький блок: строки и поля пересекают границы блоков
+        std::istringstream input("a\tbcdefgh\t\tc\r\n\n'x\t=A1\n\t\tlast");
+        TsvReader reader(input, 4);
+        std::vector<std::pair<Position, std::string>> fields;
+        reader.ForEachField([&fields](Position pos, std::string_view text) {
+            fields.emplace_back(pos, std::string(text));
+        });
+        const std::vector<std::pair<Position, std::string>> expected = {
+            { "A1"_pos, "a" }, { "B1"_pos, "bcdefgh" }, { "D1"_pos, "c" },
+            { "A3"_pos, "'x" }, { "B3"_pos, "=A1" }, { "C4"_pos, "last" },
+        };
+        ASSERT(fields == expected);
+    }
+
+    void TestImportTexts() {
+        // формулы ссылаются на ячейки следующих пакетов SetCells
+        SheetImpl sheet;
+        const int rows = 5000;
+        for (int row = 0; row < rows; ++row) {
+            sheet.SetCell(Position{ row, 0 }, std::to_string(row));
+            sheet.SetCell(Position{ row, 2 }, "=A" + std::to_string(rows - row) + "+1");
+        }
+        sheet.SetCell("B1"_pos, "'=escaped");
+        sheet.SetCell("D3"_pos, "=SUM(A1:A5000)");
+        std::ostringstream texts;
+        sheet.PrintTexts(texts);
+
+        SheetImpl imported;
+        std::istringstream input(texts.str());
+        imported.ImportTexts(input);
+        ASSERT_EQUAL(PrintSheet(imported, false), texts.str());
+        ASSERT_EQUAL(PrintSheet(imported, true), PrintSheet(sheet, true));
+        ASSERT_EQUAL(imported.GetCell("B1"_pos)->GetValue(), CellInterface::Value("=escaped"));
+        imported.SetCell("A5000"_pos, "0");
+        ASSERT_EQUAL(imported.GetCell("C1"_pos)->GetValue(), CellInterface::Value(1.0));
+
+        std::FILE* file = std::tmpfile();
+        ASSERT(file != nullptr);
+        const std::string text = "1\t=A1*2\n\t=B1+A1\n";
+        std::fwrite(text.data(), 1, text.size(), file);
+        std::fflush(file);
+        std::rewind(file);
+        SheetImpl from_fd;
+        from_fd.ImportTexts(fileno(file));
+        std::fclose(file);
+        ASSERT_EQUAL(from_fd.GetCell("B2"_pos)->GetValue(), CellInterface::Value(3.0));
+        ASSERT(from_fd.GetPrintableSize() == (Size{ 2, 2 }));
+    }
+
+    void TestSheetFacade() {
+        const std::string path = "spreadsheet_test_facade.bin";
+        Sheet sheet;
+        std::istringstream input("1\t=A1+1\n=B1*10\n");
+        sheet.ImportTexts(input);
+        sheet.SetCell("C1"_pos, "=A2/B1");
+        ASSERT_EQUAL(sheet.GetCell("C1"_pos)->GetValue(), CellInterface::Value(10.0));
+        ASSERT(sheet.GetImpl().GetConcreteCell("A1"_pos)->IsUpReferenced());
+
+        sheet.SaveSnapshot(path);
+        std::unique_ptr<Sheet> loaded = Sheet::LoadSnapshot(path);
+        std::remove(path.c_str());
+        std::ostringstream expected;
+        std::ostringstream actual;
+        sheet.PrintValues(expected);
+        loaded->PrintValues(actual);
+        ASSERT_EQUAL(actual.str(), expected.str());
+        loaded->SetCell("A1"_pos, "3");
+        ASSERT_EQUAL(loaded->GetCell("C1"_pos)->GetValue(), CellInterface::Value(10.0));
+        ASSERT_EQUAL(loaded->GetCell("A2"_pos)->GetValue(), CellInterface::Value(40.0));
+
+        bool caught = false;
+        try {
+            Sheet::LoadSnapshot(path);
+        }
+        catch (const SnapshotException&) {
+            caught = true;
+        }
+        ASSERT(caught);
     }
 
 }  // namespace
@@ -109,9 +1302,41 @@ int main() {
     TestRunner tr;
     RUN_TEST(tr, TestEmpty);
     RUN_TEST(tr, TestInvalidPosition);
+    RUN_TEST(tr, TestPositionConversion);
     RUN_TEST(tr, TestSetCellPlainText);
     RUN_TEST(tr, TestClearCell);
     RUN_TEST(tr, TestPrint);
+    RUN_TEST(tr, TestPrintLargeSheet);
+    RUN_TEST(tr, TestFormulaEvaluation);
+    RUN_TEST(tr, TestAggregateFunctions);
+    RUN_TEST(tr, TestNumericText);
+    RUN_TEST(tr, TestDeepFormula);
+    RUN_TEST(tr, TestSparseCells);
+    RUN_TEST(tr, TestPrintableBounds);
+    RUN_TEST(tr, TestRecalculation);
+    RUN_TEST(tr, TestRecalcStats);
+    RUN_TEST(tr, TestRangeRecalculation);
+    RUN_TEST(tr, TestRangeIndex);
+    RUN_TEST(tr, TestPlaceholderIndex);
+    RUN_TEST(tr, TestLongDependencyChain);
+    RUN_TEST(tr, TestParallelRecalculation);
+    RUN_TEST(tr, TestCircularDependency);
+    RUN_TEST(tr, TestLongCircularDependency);
+    RUN_TEST(tr, TestRangeCircularDependency);
+    RUN_TEST(tr, TestSelfReference);
+    RUN_TEST(tr, TestReferenceToSimilarName);
+    RUN_TEST(tr, TestUpReferencesRemoval);
+    RUN_TEST(tr, TestMemoryReport);
+    RUN_TEST(tr, TestPlaceholders);
+    RUN_TEST(tr, TestSetCells);
+    RUN_TEST(tr, TestSetCellsIsAtomic);
+    RUN_TEST(tr, TestPrattParserMatchesAntlr);
+    RUN_TEST(tr, TestFormulaInterning);
+    RUN_TEST(tr, TestSnapshot);
+    RUN_TEST(tr, TestSnapshotCorruption);
+    RUN_TEST(tr, TestTsvReader);
+    RUN_TEST(tr, TestImportTexts);
+    RUN_TEST(tr, TestSheetFacade);
 
  //  auto sheet = CreateSheet();
  //  sheet->SetCell("A1"_pos, "=(1+2)*3");
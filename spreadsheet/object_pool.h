@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+// Пул объектов одного типа: память выделяется блоками по CHUNK_SIZE объектов,
+// освобожденные места переиспользуются через список свободных слотов.
+// Блок занимает CHUNK_BYTES, выровнен на свой размер и начинается с указателя
+// на владельца пула, поэтому объект находит владельца по своему адресу
+// (GetOwner) и не хранит ссылку на него сам.
+// Живые объекты должны быть удалены через Delete() до разрушения пула.
+template <typename T, typename Owner>
+class ObjectPool {
+    union Slot {
+        Slot* next;
+        alignas(T) unsigned char storage[sizeof(T)];
+    };
+
+    // указатель на владельца, выровненный до слота
+    static constexpr std::size_t HEADER_BYTES = (sizeof(Owner*) + alignof(Slot) - 1) / alignof(Slot) * alignof(Slot);
+
+public:
+    static constexpr std::size_t CHUNK_BYTES = 16384;
+    static constexpr std::size_t CHUNK_SIZE = (CHUNK_BYTES - HEADER_BYTES) / sizeof(Slot);
+
+    explicit ObjectPool(Owner* owner) : owner_(owner) {}
+    ObjectPool(const ObjectPool&) = delete;
+    ObjectPool& operator=(const ObjectPool&) = delete;
+
+    template <typename... Args>
+    T* New(Args&&... args) {
+        Slot* slot = Allocate();
+        try {
+            return new (slot->storage) T(std::forward<Args>(args)...);
+        }
+        catch (...) {
+            Release(slot);
+            throw;
+        }
+    }
+
+    void Delete(T* object) {
+        object->~T();
+        Release(reinterpret_cast<Slot*>(object));
+    }
+
+    // Владелец пула, из которого выделен object
+    static Owner* GetOwner(const T* object) {
+        const auto address = reinterpret_cast<std::uintptr_t>(object) & ~std::uintptr_t(CHUNK_BYTES - 1);
+        return reinterpret_cast<const Chunk*>(address)->owner;
+    }
+
+private:
+    struct Chunk {
+        Owner* owner;
+        Slot slots[CHUNK_SIZE];
+    };
+    static_assert(sizeof(Chunk) <= CHUNK_BYTES, "chunk does not fit its alignment");
+
+    struct ChunkDeleter {
+        void operator()(Chunk* chunk) const {
+            chunk->~Chunk();
+            ::operator delete(chunk, std::align_val_t(CHUNK_BYTES));
+        }
+    };
+
+    Owner* owner_;
+    std::vector<std::unique_ptr<Chunk, ChunkDeleter>> chunks_;
+    Slot* free_ = nullptr;
+
+    Slot* Allocate() {
+        if (free_ == nullptr) {
+            void* memory = ::operator new(CHUNK_BYTES, std::align_val_t(CHUNK_BYTES));
+            std::unique_ptr<Chunk, ChunkDeleter> chunk(new (memory) Chunk);
+            chunk->owner = owner_;
+            Slot* slots = chunk->slots;
+            chunks_.push_back(std::move(chunk));
+            // слоты выдаются по возрастанию адресов
+            for (std::size_t i = CHUNK_SIZE; i > 0; --i) {
+                slots[i - 1].next = free_;
+                free_ = &slots[i - 1];
+            }
+        }
+        Slot* slot = free_;
+        free_ = slot->next;
+        return slot;
+    }
+
+    void Release(Slot* slot) {
+        slot->next = free_;
+        free_ = slot;
+    }
+};
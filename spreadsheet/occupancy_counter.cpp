@@ -0,0 +1,65 @@
+#include "occupancy_counter.h"
+
+#include <cassert>
+
+namespace {
+// Номер старшего установленного бита, word != 0
+int HighestBit(std::uint64_t word) {
+    int bit = 0;
+    for (int shift = 32; shift > 0; shift /= 2) {
+        if (word >> shift) {
+            word >>= shift;
+            bit += shift;
+        }
+    }
+    return bit;
+}
+}  // namespace
+
+void OccupancyCounter::Increment(int index) {
+    if (index >= static_cast<int>(counts_.size())) {
+        Grow(index);
+    }
+    if (counts_[index]++ == 0) {
+        const int word = index / WORD_BITS;
+        words_[word] |= std::uint64_t(1) << (index % WORD_BITS);
+        summary_[word / WORD_BITS] |= std::uint64_t(1) << (word % WORD_BITS);
+        if (index >= end_) {
+            end_ = index + 1;
+        }
+    }
+}
+
+void OccupancyCounter::Decrement(int index) {
+    assert(index < static_cast<int>(counts_.size()) && counts_[index] > 0);
+    if (--counts_[index] > 0) {
+        return;
+    }
+    const int word = index / WORD_BITS;
+    words_[word] &= ~(std::uint64_t(1) << (index % WORD_BITS));
+    if (words_[word] == 0) {
+        summary_[word / WORD_BITS] &= ~(std::uint64_t(1) << (word % WORD_BITS));
+    }
+    if (index + 1 == end_) {
+        end_ = FindLast() + 1;
+    }
+}
+
+void OccupancyCounter::Grow(int index) {
+    // счетчики растут целыми словами сводки, чтобы уровни карты совпадали
+    const std::size_t span = std::size_t(WORD_BITS) * WORD_BITS;
+    const std::size_t size = (std::size_t(index) / span + 1) * span;
+    counts_.resize(size);
+    words_.resize(size / WORD_BITS);
+    summary_.resize(size / span);
+}
+
+int OccupancyCounter::FindLast() const {
+    for (std::size_t i = summary_.size(); i > 0; --i) {
+        if (summary_[i - 1] != 0) {
+            const int word = int(i - 1) * WORD_BITS + HighestBit(summary_[i - 1]);
+            return word * WORD_BITS + HighestBit(words_[word]);
+        }
+    }
+    return -1;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// Число занятых ячеек в каждой строке (или столбце) листа и граница
+// последней непустой. Непустые индексы отмечены в двухуровневой битовой
+// карте: при опустошении последнего индекса следующий непустой находится
+// просмотром нескольких слов, а не всех индексов. Граница читается за O(1).
+class OccupancyCounter {
+public:
+    void Increment(int index);
+    void Decrement(int index);
+
+    // Индекс последней непустой строки + 1, 0 - если все пусты
+    int GetEnd() const {
+        return end_;
+    }
+
+private:
+    static constexpr int WORD_BITS = 64;
+
+    std::vector<std::uint32_t> counts_;
+    // бит i - counts_[i] > 0
+    std::vector<std::uint64_t> words_;
+    // бит i - words_[i] != 0
+    std::vector<std::uint64_t> summary_;
+    int end_ = 0;
+
+    void Grow(int index);
+    int FindLast() const;
+};
@@ -0,0 +1,84 @@
+#include "placeholder_index.h"
+
+#include <algorithm>
+#include <cassert>
+#include <functional>
+
+namespace {
+const std::vector<Cell*> NO_UP_REFERENCES;
+}  // namespace
+
+void PlaceholderIndex::Insert(Position pos, Cell* cell) {
+    std::vector<Cell*>& cells = FindOrInsert(pos).cells;
+    auto it = std::lower_bound(cells.begin(), cells.end(), cell, std::less<Cell*>());
+    if (it == cells.end() || *it != cell) {
+        cells.insert(it, cell);
+    }
+}
+
+void PlaceholderIndex::Erase(Position pos, Cell* cell) {
+    const std::uint32_t index = table_.Find(pos);
+    if (index == PositionTable::NOT_FOUND) {
+        return;
+    }
+    std::vector<Cell*>& cells = entries_[index].cells;
+    auto it = std::lower_bound(cells.begin(), cells.end(), cell, std::less<Cell*>());
+    if (it != cells.end() && *it == cell) {
+        cells.erase(it);
+        if (cells.empty()) {
+            EraseEntry(index);
+        }
+    }
+}
+
+const std::vector<Cell*>& PlaceholderIndex::Get(Position pos) const {
+    const std::uint32_t index = table_.Find(pos);
+    return index != PositionTable::NOT_FOUND ? entries_[index].cells : NO_UP_REFERENCES;
+}
+
+std::vector<Cell*> PlaceholderIndex::Take(Position pos) {
+    const std::uint32_t index = table_.Find(pos);
+    if (index == PositionTable::NOT_FOUND) {
+        return {};
+    }
+    std::vector<Cell*> cells = std::move(entries_[index].cells);
+    EraseEntry(index);
+    return cells;
+}
+
+void PlaceholderIndex::Put(Position pos, std::vector<Cell*> cells) {
+    if (cells.empty()) {
+        return;
+    }
+    Entry& entry = FindOrInsert(pos);
+    assert(entry.cells.empty());
+    entry.cells = std::move(cells);
+}
+
+std::size_t PlaceholderIndex::GetHeapSize() const {
+    std::size_t size = entries_.capacity() * sizeof(Entry) + table_.GetHeapSize();
+    for (const Entry& entry : entries_) {
+        size += entry.cells.capacity() * sizeof(Cell*);
+    }
+    return size;
+}
+
+PlaceholderIndex::Entry& PlaceholderIndex::FindOrInsert(Position pos) {
+    std::uint32_t index = table_.Find(pos);
+    if (index == PositionTable::NOT_FOUND) {
+        index = static_cast<std::uint32_t>(entries_.size());
+        table_.Set(pos, index);
+        entries_.push_back({ pos, {} });
+    }
+    return entries_[index];
+}
+
+void PlaceholderIndex::EraseEntry(std::uint32_t index) {
+    table_.Erase(entries_[index].pos);
+    // последняя запись занимает место удаленной
+    if (index + 1 != entries_.size()) {
+        entries_[index] = std::move(entries_.back());
+        table_.Set(entries_[index].pos, index);
+    }
+    entries_.pop_back();
+}
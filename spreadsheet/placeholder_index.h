@@ -0,0 +1,55 @@
+#pragma once
+
+#include "common.h"
+#include "position_table.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class Cell;
+
+// Обратные ссылки на пустые позиции: формулы, ссылающиеся на позицию, где
+// нет ячейки. Ячейки для таких позиций не создаются, поэтому ссылка на
+// далекую пустую позицию не выделяет ячейку и не расширяет печатную область.
+// Ячейка, записанная в позицию, забирает ее ссылки из индекса, а ссылки на
+// очищенную ячейку возвращаются в индекс.
+//
+// Записи лежат подряд в одном массиве, позиция находит свою запись через
+// PositionTable. Удаленную запись заменяет последняя.
+class PlaceholderIndex {
+public:
+    void Insert(Position pos, Cell* cell);
+    // Удаляет ссылку cell на pos, если она есть
+    void Erase(Position pos, Cell* cell);
+
+    // Формулы, ссылающиеся на pos, упорядочены по адресу, как в
+    // Cell::GetUpReferenceCells()
+    const std::vector<Cell*>& Get(Position pos) const;
+    // Забирает ссылки на pos, позиция удаляется из индекса
+    std::vector<Cell*> Take(Position pos);
+    // Помещает ссылки на pos, в индексе их для pos быть не должно
+    void Put(Position pos, std::vector<Cell*> cells);
+
+    // Число пустых позиций, на которые ссылаются формулы
+    std::size_t GetSize() const {
+        return entries_.size();
+    }
+
+    // Память записей, таблицы и списков ссылок
+    std::size_t GetHeapSize() const;
+
+private:
+    struct Entry {
+        Position pos;
+        std::vector<Cell*> cells;
+    };
+
+    std::vector<Entry> entries_;
+    // позиция - номер записи
+    PositionTable table_;
+
+    // Запись позиции, новая - с пустым списком
+    Entry& FindOrInsert(Position pos);
+    void EraseEntry(std::uint32_t index);
+};
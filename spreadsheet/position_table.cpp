@@ -0,0 +1,102 @@
+#include "position_table.h"
+
+#include <algorithm>
+
+std::uint32_t PositionTable::Find(Position pos) const {
+    const std::size_t slot = FindSlot(pos.Pack());
+    return slot != NO_SLOT ? slots_[slot].value : NOT_FOUND;
+}
+
+void PositionTable::Set(Position pos, std::uint32_t value) {
+    if (2 * (size_ + 1) > slots_.size()) {
+        Grow();
+    }
+    const std::uint32_t key = pos.Pack();
+    const std::size_t mask = slots_.size() - 1;
+    std::size_t index = GetHome(key);
+    while (slots_[index].key != key && slots_[index].key != NO_KEY) {
+        index = (index + 1) & mask;
+    }
+    if (slots_[index].key == NO_KEY) {
+        slots_[index].key = key;
+        ++size_;
+    }
+    slots_[index].value = value;
+}
+
+void PositionTable::Erase(Position pos) {
+    const std::size_t slot = FindSlot(pos.Pack());
+    if (slot == NO_SLOT) {
+        return;
+    }
+    // слот из цепочки за дыркой переносится в нее, если дырка лежит между
+    // домашним слотом и текущим
+    const std::size_t mask = slots_.size() - 1;
+    std::size_t hole = slot;
+    for (std::size_t next = (hole + 1) & mask; slots_[next].key != NO_KEY; next = (next + 1) & mask) {
+        const std::size_t home = GetHome(slots_[next].key);
+        if (((next - home) & mask) >= ((next - hole) & mask)) {
+            slots_[hole] = slots_[next];
+            hole = next;
+        }
+    }
+    slots_[hole] = Slot();
+    --size_;
+}
+
+void PositionTable::Reset(std::size_t count) {
+    std::size_t slot_count = MIN_SLOTS;
+    while (slot_count < 2 * count) {
+        slot_count *= 2;
+    }
+    Allocate(slot_count);
+    size_ = 0;
+}
+
+std::size_t PositionTable::GetHome(std::uint32_t key) const {
+    // соседние позиции строки (ключи отличаются младшими битами) лежат в
+    // соседних слотах, поэтому обход строки не промахивается мимо кэша на
+    // каждой позиции; группы разбрасываются старшими битами произведения
+    const std::uint64_t hash = std::uint64_t(key >> GROUP_BITS) * 0x9E3779B97F4A7C15ull;
+    const std::size_t group = static_cast<std::size_t>(hash >> shift_);
+    return (group + (key & ((1u << GROUP_BITS) - 1))) & (slots_.size() - 1);
+}
+
+std::size_t PositionTable::FindSlot(std::uint32_t key) const {
+    if (size_ == 0) {
+        return NO_SLOT;
+    }
+    const std::size_t mask = slots_.size() - 1;
+    for (std::size_t index = GetHome(key);; index = (index + 1) & mask) {
+        if (slots_[index].key == key) {
+            return index;
+        }
+        if (slots_[index].key == NO_KEY) {
+            return NO_SLOT;
+        }
+    }
+}
+
+void PositionTable::Allocate(std::size_t slot_count) {
+    slots_.assign(slot_count, Slot());
+    shift_ = 64;
+    for (std::size_t count = slot_count; count > 1; count /= 2) {
+        --shift_;
+    }
+}
+
+void PositionTable::Grow() {
+    std::vector<Slot> old_slots = std::move(slots_);
+    Allocate(std::max(MIN_SLOTS, 2 * old_slots.size()));
+    const std::size_t mask = slots_.size() - 1;
+    for (const Slot& slot : old_slots) {
+        if (slot.key == NO_KEY) {
+            continue;
+        }
+        std::size_t index = GetHome(slot.key);
+        while (slots_[index].key != NO_KEY) {
+            index = (index + 1) & mask;
+        }
+        slots_[index] = slot;
+    }
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "common.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Отображение позиции в 32-битное значение. Таблица с открытой адресацией и
+// линейным пробированием: слот хранит упакованную позицию и значение, поэтому
+// вставка не выделяет узел, а рост таблицы перестраивает один массив.
+// Удаление сдвигает следующие слоты цепочки на место удаленного, метки
+// удаленных слотов не нужны.
+class PositionTable {
+public:
+    static constexpr std::uint32_t NOT_FOUND = UINT32_MAX;
+
+    // Значение позиции или NOT_FOUND
+    std::uint32_t Find(Position pos) const;
+    // Вставляет позицию или заменяет ее значение
+    void Set(Position pos, std::uint32_t value);
+    void Erase(Position pos);
+    // Удаляет все позиции; таблица готова принять count позиций без роста
+    void Reset(std::size_t count);
+
+    std::size_t GetSize() const {
+        return size_;
+    }
+
+    std::size_t GetHeapSize() const {
+        return slots_.capacity() * sizeof(Slot);
+    }
+
+private:
+    // Position::Pack() корректной позиции занимает 28 бит
+    static constexpr std::uint32_t NO_KEY = UINT32_MAX;
+    static constexpr std::size_t NO_SLOT = SIZE_MAX;
+    static constexpr std::size_t MIN_SLOTS = 16;
+    // 16 соседних столбцов строки хэшируются в соседние слоты
+    static constexpr int GROUP_BITS = 4;
+
+    struct Slot {
+        std::uint32_t key = NO_KEY;
+        std::uint32_t value = 0;
+    };
+
+    // число слотов - степень двойки, заполнено не больше половины
+    std::vector<Slot> slots_;
+    std::size_t size_ = 0;
+    int shift_ = 64;
+
+    std::size_t GetHome(std::uint32_t key) const;
+    std::size_t FindSlot(std::uint32_t key) const;
+    // Пустые слоты числом slot_count, степень двойки
+    void Allocate(std::size_t slot_count);
+    void Grow();
+};
@@ -0,0 +1,221 @@
+#include "range_index.h"
+
+#include <algorithm>
+#include <cassert>
+
+namespace {
+CellRange Union(const CellRange& lhs, const CellRange& rhs) {
+    return { { std::min(lhs.from.row, rhs.from.row), std::min(lhs.from.col, rhs.from.col) },
+             { std::max(lhs.to.row, rhs.to.row), std::max(lhs.to.col, rhs.to.col) } };
+}
+
+std::int64_t Area(const CellRange& range) {
+    return std::int64_t(range.to.row - range.from.row + 1) * (range.to.col - range.from.col + 1);
+}
+
+bool Covers(const CellRange& outer, const CellRange& inner) {
+    return outer.Contains(inner.from) && outer.Contains(inner.to);
+}
+}  // namespace
+
+RangeIndex::RangeIndex()
+    : root_(NewNode(true)) {
+}
+
+void RangeIndex::Insert(const CellRange& range, Cell* cell) {
+    const std::uint32_t leaf = ChooseLeaf(range);
+    Node& node = nodes_[leaf];
+    node.boxes[node.count] = range;
+    node.cells[node.count] = cell;
+    ++node.count;
+    ++size_;
+    UpdateBounds(leaf);
+    if (nodes_[leaf].count > MAX_ENTRIES) {
+        Split(leaf);
+    }
+}
+
+void RangeIndex::Erase(const CellRange& range, Cell* cell) {
+    std::uint32_t entry = 0;
+    std::uint32_t index = FindLeaf(root_, range, cell, entry);
+    if (index == NO_NODE) {
+        return;
+    }
+    Node& leaf = nodes_[index];
+    --leaf.count;
+    leaf.boxes[entry] = leaf.boxes[leaf.count];
+    leaf.cells[entry] = leaf.cells[leaf.count];
+    --size_;
+
+    // опустевшие узлы удаляются из родителя; неполные узлы не сливаются,
+    // дерево остается корректным, лишь менее плотным
+    while (nodes_[index].count == 0 && nodes_[index].parent != NO_NODE) {
+        const std::uint32_t parent_index = nodes_[index].parent;
+        Node& parent = nodes_[parent_index];
+        const auto slot = std::find(parent.children.begin(), parent.children.begin() + parent.count, index);
+        assert(slot != parent.children.begin() + parent.count);
+        const std::size_t i = slot - parent.children.begin();
+        --parent.count;
+        parent.boxes[i] = parent.boxes[parent.count];
+        parent.children[i] = parent.children[parent.count];
+        FreeNode(index);
+        index = parent_index;
+    }
+    UpdateBounds(index);
+
+    // корень с единственным ребенком заменяется этим ребенком
+    while (!nodes_[root_].is_leaf && nodes_[root_].count == 1) {
+        const std::uint32_t child = nodes_[root_].children[0];
+        FreeNode(root_);
+        root_ = child;
+        nodes_[root_].parent = NO_NODE;
+    }
+    if (nodes_[root_].count == 0) {
+        nodes_[root_].is_leaf = true;
+    }
+}
+
+std::uint32_t RangeIndex::NewNode(bool is_leaf) {
+    std::uint32_t index;
+    if (!free_nodes_.empty()) {
+        index = free_nodes_.back();
+        free_nodes_.pop_back();
+        nodes_[index] = Node{};
+    }
+    else {
+        index = static_cast<std::uint32_t>(nodes_.size());
+        nodes_.emplace_back();
+    }
+    nodes_[index].is_leaf = is_leaf;
+    return index;
+}
+
+void RangeIndex::FreeNode(std::uint32_t index) {
+    free_nodes_.push_back(index);
+}
+
+CellRange RangeIndex::GetBounds(std::uint32_t index) const {
+    const Node& node = nodes_[index];
+    assert(node.count > 0);
+    CellRange bounds = node.boxes[0];
+    for (std::uint32_t i = 1; i < node.count; ++i) {
+        bounds = Union(bounds, node.boxes[i]);
+    }
+    return bounds;
+}
+
+std::uint32_t RangeIndex::ChooseLeaf(const CellRange& range) const {
+    // спуск в ребенка, чей прямоугольник увеличится меньше всего
+    std::uint32_t index = root_;
+    while (!nodes_[index].is_leaf) {
+        const Node& node = nodes_[index];
+        std::uint32_t best = 0;
+        std::int64_t best_growth = 0;
+        std::int64_t best_area = 0;
+        for (std::uint32_t i = 0; i < node.count; ++i) {
+            const std::int64_t area = Area(node.boxes[i]);
+            const std::int64_t growth = Area(Union(node.boxes[i], range)) - area;
+            if (i == 0 || growth < best_growth || (growth == best_growth && area < best_area)) {
+                best = i;
+                best_growth = growth;
+                best_area = area;
+            }
+        }
+        index = node.children[best];
+    }
+    return index;
+}
+
+std::uint32_t RangeIndex::FindLeaf(std::uint32_t index, const CellRange& range, Cell* cell,
+                                   std::uint32_t& entry) const {
+    const Node& node = nodes_[index];
+    for (std::uint32_t i = 0; i < node.count; ++i) {
+        if (node.is_leaf) {
+            if (node.cells[i] == cell && node.boxes[i] == range) {
+                entry = i;
+                return index;
+            }
+        }
+        else if (Covers(node.boxes[i], range)) {
+            const std::uint32_t leaf = FindLeaf(node.children[i], range, cell, entry);
+            if (leaf != NO_NODE) {
+                return leaf;
+            }
+        }
+    }
+    return NO_NODE;
+}
+
+void RangeIndex::Split(std::uint32_t index) {
+    // записи упорядочиваются по центру вдоль более протяженной оси узла
+    // и делятся пополам
+    const Node full = nodes_[index];
+    const CellRange bounds = GetBounds(index);
+    const bool by_rows = bounds.to.row - bounds.from.row >= bounds.to.col - bounds.from.col;
+    std::array<std::uint32_t, MAX_ENTRIES + 1> order;
+    for (std::uint32_t i = 0; i < full.count; ++i) {
+        order[i] = i;
+    }
+    std::sort(order.begin(), order.begin() + full.count, [&full, by_rows](std::uint32_t lhs, std::uint32_t rhs) {
+        const CellRange& a = full.boxes[lhs];
+        const CellRange& b = full.boxes[rhs];
+        return by_rows ? a.from.row + a.to.row < b.from.row + b.to.row
+                       : a.from.col + a.to.col < b.from.col + b.to.col;
+    });
+
+    const std::uint32_t sibling = NewNode(full.is_leaf);
+    const std::uint32_t half = full.count / 2;
+    nodes_[index].count = 0;
+    for (std::uint32_t i = 0; i < full.count; ++i) {
+        const std::uint32_t target = i < half ? index : sibling;
+        Node& node = nodes_[target];
+        node.boxes[node.count] = full.boxes[order[i]];
+        if (full.is_leaf) {
+            node.cells[node.count] = full.cells[order[i]];
+        }
+        else {
+            node.children[node.count] = full.children[order[i]];
+            nodes_[full.children[order[i]]].parent = target;
+        }
+        ++node.count;
+    }
+
+    if (full.parent == NO_NODE) {
+        const std::uint32_t root = NewNode(false);
+        nodes_[root].count = 2;
+        SetChild(root, 0, index);
+        SetChild(root, 1, sibling);
+        root_ = root;
+        return;
+    }
+    // охватывающий прямоугольник родителя не меняется
+    const std::uint32_t parent_index = full.parent;
+    Node& parent = nodes_[parent_index];
+    const auto slot = std::find(parent.children.begin(), parent.children.begin() + parent.count, index);
+    SetChild(parent_index, static_cast<std::uint32_t>(slot - parent.children.begin()), index);
+    SetChild(parent_index, parent.count++, sibling);
+    if (parent.count > MAX_ENTRIES) {
+        Split(parent_index);
+    }
+}
+
+void RangeIndex::UpdateBounds(std::uint32_t index) {
+    while (nodes_[index].parent != NO_NODE && nodes_[index].count > 0) {
+        Node& parent = nodes_[nodes_[index].parent];
+        const auto slot = std::find(parent.children.begin(), parent.children.begin() + parent.count, index);
+        assert(slot != parent.children.begin() + parent.count);
+        CellRange& box = parent.boxes[slot - parent.children.begin()];
+        const CellRange bounds = GetBounds(index);
+        if (box == bounds) {
+            return;
+        }
+        box = bounds;
+        index = nodes_[index].parent;
+    }
+}
+
+void RangeIndex::SetChild(std::uint32_t parent, std::uint32_t slot, std::uint32_t child) {
+    nodes_[parent].boxes[slot] = GetBounds(child);
+    nodes_[parent].children[slot] = child;
+    nodes_[child].parent = parent;
+}
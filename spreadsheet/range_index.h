@@ -0,0 +1,85 @@
+#pragma once
+
+#include "common.h"
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+class Cell;
+
+// Ребра зависимостей от диапазонов: формула, аргумент которой - диапазон,
+// хранится одной записью на диапазон, а не обратной ссылкой в каждой его
+// ячейке. Поэтому ячейки диапазона не обязаны существовать на листе.
+//
+// Записи лежат в R-дереве: узел хранит до MAX_ENTRIES прямоугольников,
+// прямоугольник внутреннего узла охватывает все записи его поддерева. Поиск
+// формул, зависящих от ячейки, спускается только в узлы, содержащие ее
+// позицию, и занимает O(log n) для непересекающихся диапазонов. Память
+// пропорциональна числу записей, а не числу ячеек в диапазонах.
+class RangeIndex {
+public:
+    RangeIndex();
+
+    void Insert(const CellRange& range, Cell* cell);
+    // Удаляет запись, вставленную с теми же range и cell
+    void Erase(const CellRange& range, Cell* cell);
+
+    // Вызывает visitor(Cell*) для каждой формулы, диапазон которой содержит pos
+    template <typename Visitor>
+    void ForEachContaining(Position pos, Visitor&& visitor) const {
+        if (size_ > 0) {
+            VisitContaining(root_, pos, visitor);
+        }
+    }
+
+    std::size_t GetSize() const {
+        return size_;
+    }
+
+private:
+    static constexpr std::uint32_t MAX_ENTRIES = 16;
+    static constexpr std::uint32_t NO_NODE = UINT32_MAX;
+
+    // лишний элемент принимает запись перед разделением переполненного узла
+    struct Node {
+        std::array<CellRange, MAX_ENTRIES + 1> boxes;
+        std::array<Cell*, MAX_ENTRIES + 1> cells;             // записи листа
+        std::array<std::uint32_t, MAX_ENTRIES + 1> children;  // дети внутреннего узла
+        std::uint32_t count = 0;
+        std::uint32_t parent = NO_NODE;
+        bool is_leaf = true;
+    };
+
+    std::vector<Node> nodes_;
+    std::vector<std::uint32_t> free_nodes_;
+    std::uint32_t root_;
+    std::size_t size_ = 0;
+
+    template <typename Visitor>
+    void VisitContaining(std::uint32_t index, Position pos, Visitor& visitor) const {
+        const Node& node = nodes_[index];
+        for (std::uint32_t i = 0; i < node.count; ++i) {
+            if (!node.boxes[i].Contains(pos)) {
+                continue;
+            }
+            if (node.is_leaf) {
+                visitor(node.cells[i]);
+            }
+            else {
+                VisitContaining(node.children[i], pos, visitor);
+            }
+        }
+    }
+
+    std::uint32_t NewNode(bool is_leaf);
+    void FreeNode(std::uint32_t index);
+    CellRange GetBounds(std::uint32_t index) const;
+    std::uint32_t ChooseLeaf(const CellRange& range) const;
+    // Находит лист с записью; entry - ее номер в листе
+    std::uint32_t FindLeaf(std::uint32_t index, const CellRange& range, Cell* cell, std::uint32_t& entry) const;
+    void Split(std::uint32_t index);
+    // Обновляет охватывающие прямоугольники от узла до корня
+    void UpdateBounds(std::uint32_t index);
+    void SetChild(std::uint32_t parent, std::uint32_t slot, std::uint32_t child);
+};
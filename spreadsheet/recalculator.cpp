@@ -0,0 +1,222 @@
+#include "recalculator.h"
+
+#include "sheet_impl.h"
+
+#include <algorithm>
+
+Recalculator::Recalculator(SheetImpl& sheet) : sheet_(sheet) {
+}
+
+void Recalculator::SetMode(Mode mode) {
+    mode_ = mode;
+}
+
+void Recalculator::SetThreadCount(std::size_t thread_count) {
+    if (thread_count == 0) {
+        thread_count = std::max(1u, std::thread::hardware_concurrency());
+    }
+    if (thread_count == GetThreadCount()) {
+        return;
+    }
+    pool_ = thread_count > 1 ? std::make_unique<ThreadPool>(thread_count) : nullptr;
+}
+
+std::size_t Recalculator::GetThreadCount() const {
+    return pool_ != nullptr ? pool_->GetThreadCount() : 1;
+}
+
+void Recalculator::Invalidate(Cell* changed, Position pos) {
+    changed_.assign(1, { pos, changed });
+    Invalidate(changed_);
+}
+
+void Recalculator::Invalidate(const std::vector<std::pair<Position, Cell*>>& changed) {
+    stats_ = {};
+    dirty_.clear();
+    invalidate_stack_.assign(changed.begin(), changed.end());
+    // в режиме Eager пересчитываются все зависимые ячейки, в том числе
+    // оставшиеся грязными с тех пор, как режим был OnDemand
+    const bool is_eager = mode_ == Mode::Eager;
+    ++epoch_;
+    if (is_eager) {
+        for (const auto& [pos, cell] : changed) {
+            cell->MarkVisited(epoch_);
+        }
+    }
+    PropagateInvalidation(is_eager);
+
+    if (is_eager) {
+        for (const auto& [pos, cell] : changed) {
+            dirty_.push_back(cell);
+        }
+        RecalculateAll(dirty_);
+    }
+}
+
+void Recalculator::InvalidateErased(Position pos) {
+    stats_ = {};
+    dirty_.clear();
+    invalidate_stack_.clear();
+    const bool is_eager = mode_ == Mode::Eager;
+    ++epoch_;
+    for (Cell* dependent : sheet_.GetPlaceholderIndex().Get(pos)) {
+        InvalidateDependent(dependent, is_eager);
+    }
+    sheet_.GetRangeIndex().ForEachContaining(pos, [this, is_eager](Cell* dependent) {
+        InvalidateDependent(dependent, is_eager);
+    });
+    PropagateInvalidation(is_eager);
+
+    if (is_eager) {
+        RecalculateAll(dirty_);
+    }
+}
+
+void Recalculator::InvalidateDependent(Cell* dependent, bool is_eager) {
+    if (is_eager ? !dependent->MarkVisited(epoch_) : dependent->IsDirty()) {
+        return;
+    }
+    dependent->ClearCache();
+    ++stats_.invalidated;
+    dirty_.push_back(dependent);
+    // зависимая ячейка - формула со ссылками, она знает свою позицию
+    invalidate_stack_.emplace_back(dependent->GetPosition(), dependent);
+}
+
+void Recalculator::InvalidateDependents(Position pos, const Cell* cell, bool is_eager) {
+    for (Cell* dependent : cell->GetUpReferenceCells()) {
+        InvalidateDependent(dependent, is_eager);
+    }
+    sheet_.GetRangeIndex().ForEachContaining(pos, [this, is_eager](Cell* dependent) {
+        InvalidateDependent(dependent, is_eager);
+    });
+}
+
+void Recalculator::PropagateInvalidation(bool is_eager) {
+    while (!invalidate_stack_.empty()) {
+        const auto [pos, cell] = invalidate_stack_.back();
+        invalidate_stack_.pop_back();
+        InvalidateDependents(pos, cell, is_eager);
+    }
+}
+
+void Recalculator::Recalculate(const Cell* cell) {
+    // повторный вход возможен только при циклической зависимости
+    if (is_running_ || !cell->IsDirty()) {
+        return;
+    }
+    ++epoch_;
+    order_.clear();
+    CollectDirty(cell);
+    RecalculateCollected();
+}
+
+void Recalculator::RecalculateAll(const std::vector<const Cell*>& cells) {
+    if (is_running_) {
+        return;
+    }
+    ++epoch_;
+    order_.clear();
+    for (const Cell* cell : cells) {
+        CollectDirty(cell);
+    }
+    RecalculateCollected();
+}
+
+void Recalculator::CollectDirty(const Cell* cell) {
+    // ячейка отмечается при раскрытии, а не при добавлении в стек: иначе общий
+    // аргумент двух ячеек мог бы попасть в order_ позже зависящей от него
+    recalc_stack_.clear();
+    recalc_stack_.push_back({ cell, false });
+    while (!recalc_stack_.empty()) {
+        Frame& frame = recalc_stack_.back();
+        const Cell* current = frame.cell;
+        if (frame.expanded) {
+            recalc_stack_.pop_back();
+            order_.push_back(current);
+            continue;
+        }
+        if (!current->IsDirty() || !current->MarkVisited(epoch_)) {
+            recalc_stack_.pop_back();
+            continue;
+        }
+        frame.expanded = true;
+        auto visit = [this](const Cell* argument) {
+            if (argument->IsDirty() && argument->GetVisitEpoch() != epoch_) {
+                recalc_stack_.push_back({ argument, false });
+            }
+        };
+        for (const Position& pos : current->GetReferencedPositions()) {
+            if (const Cell* argument = sheet_.GetConcreteCell(pos)) {
+                visit(argument);
+            }
+        }
+        for (const CellRange& range : current->GetReferencedRanges()) {
+            sheet_.ForEachCellIn(range, visit);
+        }
+    }
+}
+
+void Recalculator::RecalculateCollected() {
+    is_running_ = true;
+    if (pool_ != nullptr && order_.size() >= PARALLEL_MIN_CELLS) {
+        RecalculateByLevels();
+    }
+    else {
+        for (const Cell* cell : order_) {
+            cell->Recalculate();
+        }
+    }
+    stats_.recalculated += order_.size();
+    is_running_ = false;
+}
+
+void Recalculator::RecalculateByLevels() {
+    // уровень ячейки - длина самого длинного пути до нее от ячеек, не
+    // зависящих от других грязных; order_ уже топологически упорядочен.
+    // Ячейки order_ и только они отмечены текущим обходом CollectDirty,
+    // поэтому уровень аргумента читается из самой ячейки без поиска.
+    levels_.resize(order_.size());
+    level_offsets_.assign(1, 0);
+    for (std::size_t i = 0; i < order_.size(); ++i) {
+        const Cell* cell = order_[i];
+        std::uint32_t level = 0;
+        auto visit = [this, &level](const Cell* argument) {
+            if (argument != nullptr && argument->GetVisitEpoch() == epoch_) {
+                level = std::max(level, argument->GetRecalcLevel() + 1);
+            }
+        };
+        for (const Position& pos : cell->GetReferencedPositions()) {
+            visit(sheet_.GetConcreteCell(pos));
+        }
+        for (const CellRange& range : cell->GetReferencedRanges()) {
+            sheet_.ForEachCellIn(range, visit);
+        }
+        cell->SetRecalcLevel(level);
+        levels_[i] = level;
+        if (level + 2 > level_offsets_.size()) {
+            level_offsets_.resize(level + 2, 0);
+        }
+        ++level_offsets_[level + 1];
+    }
+    for (std::size_t level = 1; level < level_offsets_.size(); ++level) {
+        level_offsets_[level] += level_offsets_[level - 1];
+    }
+    level_order_.resize(order_.size());
+    {
+        std::vector<std::size_t> next(level_offsets_.begin(), level_offsets_.end() - 1);
+        for (std::size_t i = 0; i < order_.size(); ++i) {
+            level_order_[next[levels_[i]]++] = order_[i];
+        }
+    }
+
+    // завершение ParallelFor упорядочивает запись кэша ячеек уровня
+    // перед их чтением на следующих уровнях
+    for (std::size_t level = 0; level + 1 < level_offsets_.size(); ++level) {
+        const Cell* const* cells = level_order_.data() + level_offsets_[level];
+        auto recalculate = [cells](std::size_t i) {
+            cells[i]->Recalculate();
+        };
+        pool_->ParallelFor(level_offsets_[level + 1] - level_offsets_[level], recalculate);
+    }
+}
@@ -0,0 +1,170 @@
+#pragma once
+
+#include "cell.h"
+#include "thread_pool.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+class SheetImpl;
+
+// Пересчет формул после изменения ячеек. Граф зависимостей хранится в самих
+// ячейках: прямые ребра - GetReferencedPositions(), обратные - GetUpReferenceCells().
+// Ребра от диапазонов - GetReferencedRanges(), обратные к ним ищутся по позиции
+// ячейки в RangeIndex листа. Обратные ребра к позициям без ячеек хранятся в
+// PlaceholderIndex листа.
+// Ячейка считается "грязной", если это формула без вычисленного значения.
+// Инвариант: все ячейки, зависящие от грязной, тоже грязные, поэтому при
+// изменении ячейки обход останавливается на уже грязных ячейках.
+// Обходы графа итеративные, глубина цепочек зависимостей не ограничена стеком.
+// Посещенные ячейки отмечаются номером обхода (epoch), поэтому обход не
+// выделяет память под множества и затрагивает только достижимую часть графа.
+// Номер 64-битный и не переполняется за время жизни листа, поэтому старая
+// отметка не совпадет с текущим обходом, а 0 у новой ячейки - ни с каким.
+//
+// При числе потоков больше одного крупные пересчеты выполняются по уровням:
+// ячейки одного уровня не зависят друг от друга и вычисляются параллельно в
+// пуле потоков, уровни разделены ожиданием завершения предыдущего. По
+// умолчанию пересчет однопоточный.
+class Recalculator {
+public:
+    enum class Mode {
+        OnDemand,  // грязные ячейки вычисляются при чтении значения
+        Eager,     // грязные ячейки вычисляются сразу после изменения
+    };
+
+    // Счетчики последнего изменения. recalculated накапливается до следующего
+    // изменения, так как в режиме OnDemand пересчет происходит при чтении.
+    struct Stats {
+        std::size_t invalidated = 0;   // ячейки, чей кэш был сброшен
+        std::size_t recalculated = 0;  // вычисленные формулы
+    };
+
+    explicit Recalculator(SheetImpl& sheet);
+
+    void SetMode(Mode mode);
+    Mode GetMode() const {
+        return mode_;
+    }
+
+    // 0 - по числу аппаратных потоков, 1 - однопоточный пересчет
+    void SetThreadCount(std::size_t thread_count);
+    std::size_t GetThreadCount() const;
+
+    const Stats& GetStats() const {
+        return stats_;
+    }
+
+    // Сбрасывает кэш всех ячеек, транзитивно зависящих от changed в позиции
+    // pos, в режиме Eager сразу пересчитывает их в топологическом порядке
+    void Invalidate(Cell* changed, Position pos);
+    void Invalidate(const std::vector<std::pair<Position, Cell*>>& changed);
+    // То же для ячейки, удаленной с листа: ссылки на нее уже в индексе пустых позиций
+    void InvalidateErased(Position pos);
+
+    // Вычисляет ячейку и все грязные ячейки, от которых она зависит,
+    // в порядке обратного обхода (каждая - после своих аргументов)
+    void Recalculate(const Cell* cell);
+
+    // Пересчитывает все грязные ячейки из списка
+    void RecalculateAll(const std::vector<const Cell*>& cells);
+
+    // Проверяет, есть ли цикл среди ячеек, достижимых из roots.
+    // resolve(Position) возвращает ячейку в позиции или nullptr,
+    // for_each_in_range(CellRange, visitor) вызывает visitor(const Cell*) для
+    // ячеек диапазона, что позволяет проверить ячейки, еще не размещенные на листе.
+    template <typename Resolve, typename ForEachInRange>
+    bool HasCycle(const std::vector<const Cell*>& roots, Resolve&& resolve, ForEachInRange&& for_each_in_range);
+
+private:
+    // меньшие пересчеты не окупают синхронизацию потоков
+    static constexpr std::size_t PARALLEL_MIN_CELLS = 1024;
+
+    struct Frame {
+        const Cell* cell;
+        bool expanded;
+    };
+
+    SheetImpl& sheet_;
+    Mode mode_ = Mode::OnDemand;
+    Stats stats_;
+    bool is_running_ = false;
+    std::uint64_t epoch_ = 0;
+    std::unique_ptr<ThreadPool> pool_;
+
+    // буферы переиспользуются между вызовами
+    std::vector<std::pair<Position, const Cell*>> invalidate_stack_;
+    std::vector<std::pair<Position, Cell*>> changed_;
+    std::vector<const Cell*> dirty_;
+    std::vector<Frame> recalc_stack_;
+    std::vector<const Cell*> order_;
+    std::vector<std::uint32_t> levels_;  // уровни ячеек order_
+    std::vector<std::size_t> level_offsets_;
+    std::vector<const Cell*> level_order_;
+
+    // Добавляет в order_ грязные ячейки, от которых зависит cell, и ее саму
+    // в топологическом порядке
+    void CollectDirty(const Cell* cell);
+    // Сбрасывает кэш зависимых от cell в позиции pos и добавляет их в обход
+    void InvalidateDependents(Position pos, const Cell* cell, bool is_eager);
+    void InvalidateDependent(Cell* dependent, bool is_eager);
+    void PropagateInvalidation(bool is_eager);
+    void RecalculateCollected();
+    void RecalculateByLevels();
+};
+
+template <typename Resolve, typename ForEachInRange>
+bool Recalculator::HasCycle(const std::vector<const Cell*>& roots, Resolve&& resolve, ForEachInRange&& for_each_in_range) {
+    // ячейки на текущем пути обхода отмечаются on_path, обработанные - done;
+    // ребро в ячейку on_path замыкает цикл
+    const std::uint64_t on_path = ++epoch_;
+    const std::uint64_t done = ++epoch_;
+    bool is_cycle = false;
+    auto visit = [this, on_path, done, &is_cycle](const Cell* argument) {
+        if (argument == nullptr || !argument->IsReferenced()) {
+            return;
+        }
+        if (argument->GetVisitEpoch() == on_path) {
+            is_cycle = true;
+        }
+        else if (argument->GetVisitEpoch() != done) {
+            recalc_stack_.push_back({ argument, false });
+        }
+    };
+    for (const Cell* root : roots) {
+        recalc_stack_.clear();
+        recalc_stack_.push_back({ root, false });
+        while (!recalc_stack_.empty()) {
+            Frame& frame = recalc_stack_.back();
+            const Cell* current = frame.cell;
+            if (frame.expanded) {
+                current->SetVisitEpoch(done);
+                recalc_stack_.pop_back();
+                continue;
+            }
+            if (current->GetVisitEpoch() == done) {
+                recalc_stack_.pop_back();
+                continue;
+            }
+            // кадры выше раскрытой ячейки - ее потомки
+            if (current->GetVisitEpoch() == on_path) {
+                return true;
+            }
+            current->SetVisitEpoch(on_path);
+            frame.expanded = true;
+            for (const Position& pos : current->GetReferencedPositions()) {
+                visit(resolve(pos));
+            }
+            for (const CellRange& range : current->GetReferencedRanges()) {
+                for_each_in_range(range, visit);
+            }
+            if (is_cycle) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
@@ -1,41 +1,64 @@
 #pragma once
 
-#include "cell.h"
 #include "common.h"
 
+#include <cstddef>
 #include <functional>
+#include <iosfwd>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
 
+class SheetImpl;
+
+// Лист таблицы: SheetInterface и операции с файлами. Устройство листа скрыто
+// в SheetImpl (sheet_impl.h), поэтому этот заголовок вместе с common.h и
+// formula.h - весь устанавливаемый интерфейс.
 class Sheet : public SheetInterface {
 public:
+    Sheet();
     ~Sheet();
 
     void SetCell(Position pos, std::string text) override;
+    void SetCells(std::vector<std::pair<Position, std::string>> cells) override;
 
     const CellInterface* GetCell(Position pos) const override;
     CellInterface* GetCell(Position pos) override;
 
-    const Cell* GetConcreteCell(Position pos) const;
-    Cell* GetConcreteCell(Position pos);
-
     void ClearCell(Position pos) override;
 
     Size GetPrintableSize() const override;
 
     void PrintValues(std::ostream& output) const override;
     void PrintTexts(std::ostream& output) const override;
+    // То же с записью прямо в файловый дескриптор
+    void PrintValues(int fd) const;
+    void PrintTexts(int fd) const;
+
+    // Загружает текст в формате PrintTexts(), начиная с ячейки A1, потоком;
+    // исключение прерывает загрузку, уже прочитанная часть остается на листе
+    void ImportTexts(std::istream& input);
+    void ImportTexts(int fd);
+
+    void ForEachCellInRange(const CellRange& range,
+                            const std::function<void(const CellInterface&)>& visitor) const override;
+
+    // 0 - по числу аппаратных потоков, 1 (по умолчанию) - однопоточный пересчет
+    void SetRecalcThreadCount(std::size_t thread_count);
+    // Сбрасывает кэш всех формул листа и вычисляет их заново
+    void RecalculateAll();
+
+    // Бинарный снимок листа, ошибки чтения и записи - SnapshotException
+    void SaveSnapshot(const std::string& path) const;
+    static std::unique_ptr<Sheet> LoadSnapshot(const std::string& path);
+
+    // Устройство листа для ядра, тестов и замеров
+    SheetImpl& GetImpl();
+    const SheetImpl& GetImpl() const;
 
 private:
-    std::vector<std::vector<std::unique_ptr<Cell>>> sheet_; // vector[col][row]
-    std::unordered_set<Cell*> disabling_cache_;
-    std::unordered_set<Cell*> hold_cells_ptr_;
-
-    bool IsValidPos(Position pos) const;
-    void PrintSheet(std::ostream& output, bool is_print_value) const;
-    void IncreasePrintArea(const Position& pos);
-    void InsertEmptySell(const Position& pos);
-    void InsertPtrCellToUpReferencesListsOfCells(const std::unique_ptr<Cell>& tmp_cell);
-    void DisablingTheCache(Cell* cell_ptr);
-    void DellUpReference(Position& pos);
-    void AddUpReference(Position& pos_modify, const Position& pos_for_add);
-    bool IsNewTextCellEqualOldTextCell(Position pos, std::string text);
-};
\ No newline at end of file
+    std::unique_ptr<SheetImpl> impl_;
+
+    explicit Sheet(std::unique_ptr<SheetImpl> impl);
+};
@@ -0,0 +1,569 @@
+#include "sheet_impl.h"
+
+#include "snapshot.h"
+
+#include <algorithm>
+#include <functional>
+#include <iostream>
+#include <optional>
+#include <unordered_set>
+
+using namespace std::literals;
+
+SheetImpl::~SheetImpl() {}
+
+void SheetImpl::InsertPtrCellToUpReferencesListsOfCells(Cell* cell) {
+    for (const auto& cell_position : cell->GetReferencedPositions()) {
+        if (Cell* referenced = GetConcreteCell(cell_position)) {
+            referenced->InsertCellPtrToUpReferencedList(cell);
+        }
+        else {
+            placeholder_index_.Insert(cell_position, cell);
+        }
+    }
+    for (const CellRange& range : cell->GetReferencedRanges()) {
+        range_index_.Insert(range, cell);
+    }
+}
+
+void SheetImpl::DellUpReference(Position& pos) {
+    Cell* cell_for_dell = GetConcreteCell(pos);
+    for (const CellRange& range : cell_for_dell->GetReferencedRanges()) {
+        range_index_.Erase(range, cell_for_dell);
+    }
+    for (const Position& pos_modify : cell_for_dell->GetReferencedPositions()) {
+        RemoveUpReference(pos_modify, cell_for_dell);
+    }
+}
+
+void SheetImpl::RemoveUpReference(Position pos, Cell* dependent) {
+    if (Cell* cell = GetConcreteCell(pos)) {
+        cell->RemoveCellPtrFromUpReferencedList(dependent);
+    }
+    else {
+        placeholder_index_.Erase(pos, dependent);
+    }
+}
+
+static void CheckValidPositionInTable(Position pos) {
+    if (!pos.IsValid()) {
+        throw InvalidPositionException("");
+    }
+}
+
+bool SheetImpl::IsNewTextCellEqualOldTextCell(Position pos, std::string_view text) {
+    const Cell* cell = GetConcreteCell(pos);
+    if (cell == nullptr) {
+        return text.empty();
+    }
+    if (cell->IsFormula()) {
+        return cell->GetText() == text;
+    }
+    return cell->GetStoredText() == text;
+}
+
+void SheetImpl::SetCell(Position pos, std::string text) {
+    CheckValidPositionInTable(pos);
+    if (IsNewTextCellEqualOldTextCell(pos, text)) {
+        return;
+    }
+    BatchItem item{ pos, cells_.MakeCell() };
+    item.second->Set(text, pos);
+    cycle_roots_.clear();
+    cycle_sources_.clear();
+    AddCycleCandidate(item.second.get(), pos, CellRange{ pos, pos });
+    if (IsCircular(&item, 1)) {
+        throw CircularDependencyException(""s);
+    }
+    if (Cell* old_cell = GetConcreteCell(pos)) {
+        if (old_cell->IsReferenced()) {
+            DellUpReference(pos);
+        }
+        item.second->MoveUpReferenceFromCell(*old_cell);
+    }
+    else {
+        item.second->SetUpReferences(placeholder_index_.Take(pos));
+    }
+    Cell* cell = cells_.Put(pos, std::move(item.second));
+    if (cell->IsReferenced()) {
+        InsertPtrCellToUpReferencesListsOfCells(cell);
+    }
+    recalculator_.Invalidate(cell, pos);
+}
+
+void SheetImpl::SetCells(std::vector<std::pair<Position, std::string>> cells) {
+    if (cells.empty()) {
+        return;
+    }
+    CellRange bounds{ cells[0].first, cells[0].first };
+    for (const auto& [pos, text] : cells) {
+        CheckValidPositionInTable(pos);
+        bounds.from = { std::min(bounds.from.row, pos.row), std::min(bounds.from.col, pos.col) };
+        bounds.to = { std::max(bounds.to.row, pos.row), std::max(bounds.to.col, pos.col) };
+    }
+    std::vector<BatchItem> batch;
+    batch.reserve(cells.size());
+    cycle_roots_.clear();
+    cycle_sources_.clear();
+    // из нескольких значений позиции действует последнее
+    auto add = [this, &batch, &bounds](Position pos, std::string& text, bool is_overwritten) {
+        if (is_overwritten || IsNewTextCellEqualOldTextCell(pos, text)) {
+            return;
+        }
+        // исключение при разборе оставляет лист без изменений
+        CellStorage::CellPtr cell = cells_.MakeCell();
+        cell->Set(text, pos);
+        AddCycleCandidate(cell.get(), pos, bounds);
+        batch.emplace_back(pos, std::move(cell));
+    };
+    auto by_position = [](const auto& lhs, const auto& rhs) {
+        return lhs.first < rhs.first;
+    };
+    if (std::is_sorted(cells.begin(), cells.end(), by_position)) {
+        for (std::size_t i = 0; i < cells.size(); ++i) {
+            add(cells[i].first, cells[i].second, i + 1 < cells.size() && cells[i + 1].first == cells[i].first);
+        }
+    }
+    else {
+        // сортируются ключи "позиция, номер", а не пары со строками; номер
+        // ставит последнее значение позиции последним
+        batch_order_.clear();
+        for (std::size_t i = 0; i < cells.size(); ++i) {
+            batch_order_.push_back(std::uint64_t(cells[i].first.Pack()) << 32 | i);
+        }
+        std::sort(batch_order_.begin(), batch_order_.end());
+        for (std::size_t i = 0; i < batch_order_.size(); ++i) {
+            auto& [pos, text] = cells[static_cast<std::uint32_t>(batch_order_[i])];
+            add(pos, text, i + 1 < batch_order_.size() && (batch_order_[i + 1] >> 32) == (batch_order_[i] >> 32));
+        }
+    }
+    if (batch.empty()) {
+        return;
+    }
+    if (IsCircular(batch.data(), batch.size())) {
+        throw CircularDependencyException(""s);
+    }
+
+    // дальше исключений нет. Новая формула связывается сразу: если позицию,
+    // на которую она ссылается, заменит ячейка пакета, ссылка перейдет к ней
+    // вместе с остальными ссылками старой ячейки или индекса пустых позиций.
+    // В режиме OnDemand ячейка без зависимых формул листа не передается в
+    // Invalidate: сбрасывать нечего, а новые формулы пакета и так не вычислены
+    const bool is_eager = recalculator_.GetMode() == Recalculator::Mode::Eager;
+    changed_cells_.clear();
+    for (auto& [pos, new_cell] : batch) {
+        if (Cell* old_cell = GetConcreteCell(pos)) {
+            for (const CellRange& range : old_cell->GetReferencedRanges()) {
+                range_index_.Erase(range, old_cell);
+            }
+            for (const Position& pos_modify : old_cell->GetReferencedPositions()) {
+                RemoveUpReference(pos_modify, old_cell);
+            }
+            new_cell->MoveUpReferenceFromCell(*old_cell);
+        }
+        else {
+            new_cell->SetUpReferences(placeholder_index_.Take(pos));
+        }
+        Cell* cell = cells_.Put(pos, std::move(new_cell));
+        if (cell->IsReferenced()) {
+            InsertPtrCellToUpReferencesListsOfCells(cell);
+        }
+        if (is_eager || cell->IsUpReferenced() || range_index_.GetSize() > 0) {
+            changed_cells_.emplace_back(pos, cell);
+        }
+    }
+    recalculator_.Invalidate(changed_cells_);
+}
+
+void SheetImpl::AddCycleCandidate(const Cell* cell, Position pos, const CellRange& bounds) {
+    if (!cell->IsReferenced()) {
+        return;
+    }
+    if (HasDependents(pos)) {
+        cycle_roots_.push_back(cell);
+    }
+    // ссылки внутрь прямоугольника пакета разрешаются в IsCircular, когда
+    // известны все ячейки пакета
+    for (const Position& ref : cell->GetReferencedPositions()) {
+        if (bounds.Contains(ref)) {
+            cycle_sources_.push_back(cell);
+            return;
+        }
+    }
+    for (const CellRange& range : cell->GetReferencedRanges()) {
+        if (!(range.to.row < bounds.from.row || bounds.to.row < range.from.row ||
+              range.to.col < bounds.from.col || bounds.to.col < range.from.col)) {
+            cycle_sources_.push_back(cell);
+            return;
+        }
+    }
+}
+
+bool SheetImpl::IsCircular(const BatchItem* batch, std::size_t size) {
+    if (cycle_roots_.empty() && cycle_sources_.empty()) {
+        return false;
+    }
+    const BatchItem* const end = batch + size;
+    // позиции вне прямоугольника пакета не ищутся в таблице; таблица
+    // строится один раз на пакет и только если понадобилась
+    CellRange bounds{ batch[0].first, batch[size - 1].first };
+    for (const BatchItem* it = batch; it != end; ++it) {
+        bounds.from.col = std::min(bounds.from.col, it->first.col);
+        bounds.to.col = std::max(bounds.to.col, it->first.col);
+    }
+    bool is_table_built = size == 1;
+    auto find = [this, batch, size, &bounds, &is_table_built](Position pos) -> std::uint32_t {
+        if (!bounds.Contains(pos)) {
+            return PositionTable::NOT_FOUND;
+        }
+        if (size == 1) {
+            return 0;
+        }
+        if (!is_table_built) {
+            batch_positions_.Reset(size);
+            for (std::size_t i = 0; i < size; ++i) {
+                batch_positions_.Set(batch[i].first, static_cast<std::uint32_t>(i));
+            }
+            is_table_built = true;
+        }
+        return batch_positions_.Find(pos);
+    };
+    // позиции пакета внутри диапазона лежат в пакете между from и to
+    auto for_each_batch_cell_in = [batch, end](const CellRange& range, auto&& visitor) {
+        const BatchItem* it = std::lower_bound(batch, end, range.from, [](const BatchItem& item, Position pos) {
+            return item.first < pos;
+        });
+        for (; it != end && !(range.to < it->first); ++it) {
+            if (range.Contains(it->first)) {
+                visitor(it->second.get());
+            }
+        }
+    };
+
+    // старый лист без циклов, поэтому цикл проходит через новую формулу, и
+    // на каждую его ячейку ссылается предыдущая. Обход начинается только с
+    // новых формул, на которые ссылаются ячейки листа или пакета
+    auto add_root = [this](const Cell* cell) {
+        if (cell->IsReferenced()) {
+            cycle_roots_.push_back(cell);
+        }
+    };
+    for (const Cell* source : cycle_sources_) {
+        for (const Position& pos : source->GetReferencedPositions()) {
+            const std::uint32_t index = find(pos);
+            if (index != PositionTable::NOT_FOUND) {
+                add_root(batch[index].second.get());
+            }
+        }
+        for (const CellRange& range : source->GetReferencedRanges()) {
+            for_each_batch_cell_in(range, add_root);
+        }
+    }
+    if (cycle_roots_.empty()) {
+        return false;
+    }
+
+    // позиции пакета разрешаются в новые ячейки, остальные - в ячейки листа
+    auto resolve = [this, &find, batch](Position pos) -> const Cell* {
+        const std::uint32_t index = find(pos);
+        if (index != PositionTable::NOT_FOUND) {
+            return batch[index].second.get();
+        }
+        return GetConcreteCell(pos);
+    };
+    auto for_each_in_range = [this, &find, &for_each_batch_cell_in](const CellRange& range, auto&& visitor) {
+        cells_.ForEachCellIn(range, [&find, &visitor](Position pos, const Cell* cell) {
+            if (find(pos) == PositionTable::NOT_FOUND) {
+                visitor(cell);
+            }
+        });
+        for_each_batch_cell_in(range, visitor);
+    };
+    return recalculator_.HasCycle(cycle_roots_, resolve, for_each_in_range);
+}
+
+bool SheetImpl::HasDependents(Position pos) const {
+    if (const Cell* cell = GetConcreteCell(pos)) {
+        if (cell->IsUpReferenced()) {
+            return true;
+        }
+    }
+    else if (!placeholder_index_.Get(pos).empty()) {
+        return true;
+    }
+    bool is_in_range = false;
+    range_index_.ForEachContaining(pos, [&is_in_range](const Cell*) {
+        is_in_range = true;
+    });
+    return is_in_range;
+}
+
+const Cell* SheetImpl::GetConcreteCell(Position pos) const {
+    return cells_.Get(pos);
+}
+
+Cell* SheetImpl::GetConcreteCell(Position pos) {
+    return cells_.Get(pos);
+}
+
+const CellInterface* SheetImpl::GetCell(Position pos) const {
+    CheckValidPositionInTable(pos);
+    return cells_.Get(pos);
+}
+
+CellInterface* SheetImpl::GetCell(Position pos) {
+    CheckValidPositionInTable(pos);
+    return cells_.Get(pos);
+}
+ 
+void SheetImpl::ClearCell(Position pos) {
+    CheckValidPositionInTable(pos);
+    Cell* cell = GetConcreteCell(pos);
+    if (cell == nullptr) {
+        return;
+    }
+    if (cell->IsReferenced()) {
+        DellUpReference(pos);
+    }
+    // ссылки формул на ячейку переходят в индекс пустых позиций
+    placeholder_index_.Put(pos, cell->TakeUpReferences());
+    const bool is_empty = cell->IsEmpty();
+    cells_.Erase(pos);
+    if (!is_empty) {
+        recalculator_.InvalidateErased(pos);
+    }
+}
+
+Size SheetImpl::GetPrintableSize() const {
+    return cells_.GetBounds();
+}
+
+void SheetImpl::SetRecalcMode(Recalculator::Mode mode) {
+    recalculator_.SetMode(mode);
+}
+
+Recalculator::Mode SheetImpl::GetRecalcMode() const {
+    return recalculator_.GetMode();
+}
+
+void SheetImpl::SetRecalcThreadCount(std::size_t thread_count) {
+    recalculator_.SetThreadCount(thread_count);
+}
+
+void SheetImpl::RecalculateAll() {
+    formula_cells_.clear();
+    cells_.ForEachCell([this](Cell* cell) {
+        if (cell->IsFormula()) {
+            cell->ClearCache();
+            formula_cells_.push_back(cell);
+        }
+    });
+    recalculator_.RecalculateAll(formula_cells_);
+}
+
+const RangeIndex& SheetImpl::GetRangeIndex() const {
+    return range_index_;
+}
+
+const PlaceholderIndex& SheetImpl::GetPlaceholderIndex() const {
+    return placeholder_index_;
+}
+
+void SheetImpl::ForEachCellInRange(const CellRange& range,
+                               const std::function<void(const CellInterface&)>& visitor) const {
+    cells_.ForEachCellIn(range, [&visitor](const Cell* cell) {
+        if (!cell->IsEmpty()) {
+            visitor(*cell);
+        }
+    });
+}
+
+const Recalculator::Stats& SheetImpl::GetRecalcStats() const {
+    return recalculator_.GetStats();
+}
+
+void SheetImpl::RecalculateCell(const Cell* cell) {
+    recalculator_.Recalculate(cell);
+}
+
+SheetImpl::MemoryReport SheetImpl::GetMemoryReport() const {
+    MemoryReport report;
+    cells_.ForEachCell([&report](const Cell* cell) {
+        CellMemory& memory = cell->IsFormula() ? report.formula : cell->IsEmpty() ? report.empty : report.text;
+        ++memory.count;
+        memory.cell_bytes += sizeof(Cell);
+        memory.heap_bytes += cell->GetHeapSize();
+    });
+    report.placeholders.count = placeholder_index_.GetSize();
+    report.placeholders.heap_bytes = placeholder_index_.GetHeapSize();
+    return report;
+}
+
+FormulaCache& SheetImpl::GetFormulaCache() {
+    return formula_cache_;
+}
+
+const FormulaCache& SheetImpl::GetFormulaCache() const {
+    return formula_cache_;
+}
+
+void SheetImpl::PrintValues(std::ostream& output) const {
+    BufferedWriter writer(output);
+    PrintSheet(writer, true);
+}
+
+void SheetImpl::PrintTexts(std::ostream& output) const {
+    BufferedWriter writer(output);
+    PrintSheet(writer, false);
+}
+
+void SheetImpl::PrintValues(int fd) const {
+    BufferedWriter writer(fd);
+    PrintSheet(writer, true);
+}
+
+void SheetImpl::PrintTexts(int fd) const {
+    BufferedWriter writer(fd);
+    PrintSheet(writer, false);
+}
+
+void SheetImpl::ImportTexts(std::istream& input) {
+    TsvReader reader(input);
+    ImportTexts(reader);
+}
+
+void SheetImpl::ImportTexts(int fd) {
+    TsvReader reader(fd);
+    ImportTexts(reader);
+}
+
+void SheetImpl::ImportTexts(TsvReader& reader) {
+    // формулы могут ссылаться на ячейки следующих пакетов: до их загрузки
+    // эти ячейки пусты, как при вводе по одной ячейке
+    std::vector<std::pair<Position, std::string>> batch;
+    batch.reserve(IMPORT_BATCH_SIZE);
+    reader.ForEachField([this, &batch](Position pos, std::string_view text) {
+        batch.emplace_back(pos, std::string(text));
+        if (batch.size() == IMPORT_BATCH_SIZE) {
+            SetCells(std::move(batch));
+            batch.clear();
+            batch.reserve(IMPORT_BATCH_SIZE);
+        }
+    });
+    if (!batch.empty()) {
+        SetCells(std::move(batch));
+    }
+}
+
+// Строки обходятся по блокам хранилища, пустые блоки пропускаются. Значения
+// и тексты пишутся в буфер без промежуточных строк, кроме текста формулы.
+void SheetImpl::PrintSheet(BufferedWriter& output, bool is_print_value) const {
+    const auto [rows, cols] = GetPrintableSize();
+    for (int row = 0; row < rows; ++row) {
+        int col = 0;
+        cells_.ForEachCellIn({ { row, 0 }, { row, cols - 1 } }, [&output, &col, is_print_value](Position pos,
+                                                                                                const Cell* cell) {
+            const int cell_col = pos.col;
+            output.Write('\t', std::size_t(cell_col - col));
+            col = cell_col;
+            if (!cell->IsFormula()) {
+                std::string_view text = cell->GetStoredText();
+                if (is_print_value && !text.empty() && text[0] == ESCAPE_SIGN) {
+                    text.remove_prefix(1);
+                }
+                output.Write(text);
+            }
+            else if (!is_print_value) {
+                output.Write(cell->GetText());
+            }
+            else {
+                const CellInterface::Value value = cell->GetValue();
+                if (const double* number = std::get_if<double>(&value)) {
+                    output.Write(*number);
+                }
+                else {
+                    output.Write(std::get<FormulaError>(value).ToString());
+                }
+            }
+        });
+        output.Write('\t', std::size_t(cols - 1 - col));
+        output.Write('\n');
+    }
+    output.Flush();
+}
+
+void SheetImpl::SaveSnapshot(const std::string& path) const {
+    SnapshotWriter writer;
+    const auto [rows, cols] = GetPrintableSize();
+    cells_.ForEachCellIn({ { 0, 0 }, { rows - 1, cols - 1 } }, [&writer](Position pos, const Cell* cell) {
+        // пустая ячейка пишется текстом нулевой длины: она входит в печатную
+        // область листа
+        const FormulaInterface* formula = cell->GetFormula();
+        const auto dependent_count = static_cast<std::uint32_t>(cell->GetUpReferenceCells().size());
+        if (formula == nullptr) {
+            writer.AddText(pos, cell->GetStoredText(), dependent_count);
+        }
+        else if (auto shared = FormulaCache::GetTemplate(*formula)) {
+            writer.AddFormula(pos, shared, cell->GetCachedValue(), dependent_count);
+        }
+        else {
+            // формула вне кэша разбирается при загрузке
+            writer.AddText(pos, cell->GetText(), dependent_count);
+        }
+    });
+    writer.Save(path);
+}
+
+std::unique_ptr<SheetImpl> SheetImpl::LoadSnapshot(const std::string& path) {
+    SnapshotReader reader(path);
+    auto sheet = std::make_unique<SheetImpl>();
+    reader.InternTemplates(sheet->formula_cache_);
+    std::vector<std::pair<Position, Cell*>>& formulas = sheet->changed_cells_;
+    for (std::size_t i = 0; i < reader.GetCellCount(); ++i) {
+        SnapshotCell record = reader.GetCell(i);
+        CellStorage::CellPtr cell = sheet->cells_.MakeCell();
+        if (record.formula != nullptr) {
+            cell->SetFormula(FormulaCache::Share(std::move(record.formula), record.pos), record.pos);
+            if (record.value.has_value()) {
+                cell->SetCachedValue(*record.value);
+            }
+        }
+        else {
+            try {
+                cell->Set(record.text, record.pos);
+            }
+            catch (const FormulaException&) {
+                throw SnapshotException("snapshot is corrupted: invalid formula");
+            }
+        }
+        cell->ReserveUpReferences(record.dependent_count);
+        Cell* placed = sheet->cells_.Put(record.pos, std::move(cell));
+        if (placed->IsReferenced()) {
+            formulas.emplace_back(record.pos, placed);
+        }
+    }
+    for (const auto& [pos, cell] : formulas) {
+        sheet->InsertPtrCellToUpReferencesListsOfCells(cell);
+    }
+    // контрольные суммы не доказывают, что снимок записан листом без циклов:
+    // восстановленный граф проверяется одним обходом от всех формул
+    std::vector<const Cell*>& roots = sheet->cycle_roots_;
+    roots.clear();
+    for (const auto& [pos, cell] : formulas) {
+        roots.push_back(cell);
+    }
+    formulas.clear();
+    const SheetImpl& loaded = *sheet;
+    auto resolve = [&loaded](Position pos) {
+        return loaded.GetConcreteCell(pos);
+    };
+    auto for_each_in_range = [&loaded](const CellRange& range, auto&& visitor) {
+        loaded.ForEachCellIn(range, visitor);
+    };
+    const bool is_circular = sheet->recalculator_.HasCycle(roots, resolve, for_each_in_range);
+    roots.clear();
+    if (is_circular) {
+        throw SnapshotException("snapshot is corrupted: circular dependency");
+    }
+    return sheet;
+}
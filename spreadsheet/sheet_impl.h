@@ -0,0 +1,139 @@
+#pragma once
+
+#include "buffered_writer.h"
+#include "cell.h"
+#include "cell_storage.h"
+#include "common.h"
+#include "placeholder_index.h"
+#include "position_table.h"
+#include "range_index.h"
+#include "recalculator.h"
+#include "tsv_reader.h"
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Устройство листа за публичным Sheet (sheet.h): хранилище ячеек, индексы
+// зависимостей и пересчет. Заголовок не устанавливается, им пользуются ядро,
+// тесты и замеры.
+class SheetImpl final : public SheetInterface {
+public:
+    ~SheetImpl();
+
+    void SetCell(Position pos, std::string text) override;
+    void SetCells(std::vector<std::pair<Position, std::string>> cells) override;
+
+    const CellInterface* GetCell(Position pos) const override;
+    CellInterface* GetCell(Position pos) override;
+
+    const Cell* GetConcreteCell(Position pos) const;
+    Cell* GetConcreteCell(Position pos);
+
+    void ClearCell(Position pos) override;
+
+    Size GetPrintableSize() const override;
+
+    void PrintValues(std::ostream& output) const override;
+    void PrintTexts(std::ostream& output) const override;
+    // То же с записью прямо в файловый дескриптор
+    void PrintValues(int fd) const;
+    void PrintTexts(int fd) const;
+
+    // Загружает текст в формате PrintTexts(), начиная с ячейки A1. Вход
+    // читается потоком, ячейки передаются в SetCells() пакетами по
+    // IMPORT_BATCH_SIZE, поэтому память не зависит от размера входа.
+    // Исключение прерывает загрузку, уже переданные пакеты остаются на листе.
+    void ImportTexts(std::istream& input);
+    void ImportTexts(int fd);
+    void ImportTexts(TsvReader& reader);
+
+    void ForEachCellInRange(const CellRange& range,
+                            const std::function<void(const CellInterface&)>& visitor) const override;
+
+    // Вызывает visitor(Position, Cell*) или visitor(Cell*) для каждой ячейки
+    // диапазона, в том числе пустой
+    template <typename Visitor>
+    void ForEachCellIn(const CellRange& range, Visitor&& visitor) const {
+        cells_.ForEachCellIn(range, std::forward<Visitor>(visitor));
+    }
+
+    // Формулы, зависящие от ячеек через диапазоны
+    const RangeIndex& GetRangeIndex() const;
+    // Формулы, ссылающиеся на позиции без ячеек
+    const PlaceholderIndex& GetPlaceholderIndex() const;
+
+    void SetRecalcMode(Recalculator::Mode mode);
+    Recalculator::Mode GetRecalcMode() const;
+    // 0 - по числу аппаратных потоков, 1 (по умолчанию) - однопоточный пересчет
+    void SetRecalcThreadCount(std::size_t thread_count);
+    // Сбрасывает кэш всех формул листа и вычисляет их заново
+    void RecalculateAll();
+    // Счетчики пересчета для последнего изменения ячейки
+    const Recalculator::Stats& GetRecalcStats() const;
+    void RecalculateCell(const Cell* cell);
+
+    // Память ячеек одного вида: в самих ячейках и вне их (Cell::GetHeapSize)
+    struct CellMemory {
+        std::size_t count = 0;
+        std::size_t cell_bytes = 0;
+        std::size_t heap_bytes = 0;
+    };
+
+    struct MemoryReport {
+        CellMemory empty;
+        CellMemory text;
+        CellMemory formula;
+        // пустые позиции со ссылками формул: ячеек не занимают
+        CellMemory placeholders;
+    };
+
+    MemoryReport GetMemoryReport() const;
+
+    FormulaCache& GetFormulaCache();
+    const FormulaCache& GetFormulaCache() const;
+
+    // Бинарный снимок листа (формат - в snapshot.h): тексты, скомпилированные
+    // формулы и их вычисленные значения. Загрузка не разбирает формулы и
+    // проверяет граф зависимостей на циклы одним обходом, исключения -
+    // SnapshotException.
+    void SaveSnapshot(const std::string& path) const;
+    static std::unique_ptr<SheetImpl> LoadSnapshot(const std::string& path);
+
+private:
+    using BatchItem = std::pair<Position, CellStorage::CellPtr>;
+
+    static constexpr std::size_t IMPORT_BATCH_SIZE = 4096;
+
+    // объявлен раньше ячеек, чтобы пережить их
+    FormulaCache formula_cache_;
+    CellStorage cells_{ *this };
+    RangeIndex range_index_;
+    PlaceholderIndex placeholder_index_;
+    Recalculator recalculator_{ *this };
+    std::vector<const Cell*> formula_cells_;  // буфер для RecalculateAll
+    std::vector<std::pair<Position, Cell*>> changed_cells_;  // буфер для SetCells
+    std::vector<std::uint64_t> batch_order_;  // буфер для SetCells
+    std::vector<const Cell*> cycle_roots_;    // кандидаты для IsCircular
+    std::vector<const Cell*> cycle_sources_;
+    PositionTable batch_positions_;           // позиция - номер в пакете IsCircular
+
+    void PrintSheet(BufferedWriter& output, bool is_print_value) const;
+    void InsertPtrCellToUpReferencesListsOfCells(Cell* cell);
+    void DellUpReference(Position& pos);
+    // Удаляет ссылку dependent на pos из ячейки в pos или из индекса пустых позиций
+    void RemoveUpReference(Position pos, Cell* dependent);
+    void AddUpReference(Position& pos_modify, const Position& pos_for_add);
+    bool IsNewTextCellEqualOldTextCell(Position pos, std::string_view text);
+    // Отбирает новую ячейку пакета для IsCircular: на ее позицию ссылается
+    // лист, или ее ссылки попадают в прямоугольник пакета bounds
+    void AddCycleCandidate(const Cell* cell, Position pos, const CellRange& bounds);
+    // Замкнут ли цикл, если разместить на листе ячейки batch, упорядоченные по
+    // позиции; учитывает ячейки, отобранные AddCycleCandidate
+    bool IsCircular(const BatchItem* batch, std::size_t size);
+    // Ссылаются ли на pos формулы листа, напрямую или через диапазон
+    bool HasDependents(Position pos) const;
+};
\ No newline at end of file
@@ -0,0 +1,633 @@
+#include "snapshot.h"
+
+#include "formula_template.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+
+#ifdef _WIN32
+#include <iterator>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std::literals;
+
+namespace {
+constexpr char MAGIC[8] = { 'S', 'H', 'E', 'E', 'T', 'S', 'N', 'P' };
+constexpr std::uint32_t VERSION = 2;
+constexpr std::uint32_t BYTE_ORDER_MARK = 0x01020304;
+constexpr std::uint32_t NO_TEMPLATE = std::numeric_limits<std::uint32_t>::max();
+
+enum ValueKind : std::uint32_t {
+    VALUE_NONE,
+    VALUE_NUMBER,
+    VALUE_ERROR,
+};
+
+struct SectionEntry {
+    std::uint64_t offset;
+    std::uint64_t size;
+    std::uint64_t checksum;
+};
+
+struct Header {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t byte_order;
+    // считается по заголовку с нулевым checksum
+    std::uint64_t checksum;
+    SectionEntry sections[SNAPSHOT_SECTION_COUNT];
+};
+
+// [begin, begin + count) - записи формы в секциях программ
+struct TemplateRecord {
+    std::uint64_t expression_offset;
+    std::uint32_t expression_size;
+    std::int32_t anchor_row;
+    std::int32_t anchor_col;
+    std::uint32_t code_begin;
+    std::uint32_t code_count;
+    std::uint32_t constant_begin;
+    std::uint32_t constant_count;
+    std::uint32_t cell_begin;
+    std::uint32_t cell_count;
+    std::uint32_t call_begin;
+    std::uint32_t call_count;
+    std::uint32_t range_begin;
+    std::uint32_t range_count;
+    std::uint32_t reserved;
+};
+
+struct InstructionRecord {
+    std::uint32_t op;
+    std::uint32_t operand;
+};
+
+struct PositionRecord {
+    std::int32_t row;
+    std::int32_t col;
+};
+
+struct CallRecord {
+    std::uint32_t function;
+    std::uint32_t value_count;
+    std::uint32_t range_begin;
+    std::uint32_t range_count;
+};
+
+struct RangeRecord {
+    PositionRecord from;
+    PositionRecord to;
+};
+
+struct CellRecord {
+    std::int32_t row;
+    std::int32_t col;
+    std::uint32_t template_index;  // NO_TEMPLATE для текста
+    std::uint32_t value_kind;
+    std::uint64_t text_offset;
+    std::uint32_t text_size;
+    std::uint32_t error;
+    double number;
+    std::uint32_t dependent_count;
+    std::uint32_t reserved;
+};
+
+// записи читаются memcpy и не должны зависеть от выравнивания компилятора
+static_assert(sizeof(Header) == 24 + 24 * SNAPSHOT_SECTION_COUNT);
+static_assert(sizeof(TemplateRecord) == 64);
+static_assert(sizeof(InstructionRecord) == 8);
+static_assert(sizeof(CallRecord) == 16);
+static_assert(sizeof(RangeRecord) == 16);
+static_assert(sizeof(CellRecord) == 48);
+
+constexpr std::size_t RECORD_SIZES[SNAPSHOT_SECTION_COUNT] = {
+    1,
+    sizeof(TemplateRecord),
+    sizeof(InstructionRecord),
+    sizeof(double),
+    sizeof(PositionRecord),
+    sizeof(CallRecord),
+    sizeof(RangeRecord),
+    sizeof(CellRecord),
+};
+
+// FNV-1a по 8-байтным словам: каждый шаг обратим, поэтому изменение одного
+// слова всегда меняет сумму
+std::uint64_t Checksum(std::string_view data) {
+    constexpr std::uint64_t PRIME = 1099511628211ull;
+    std::uint64_t hash = 14695981039346656037ull;
+    std::size_t i = 0;
+    for (; i + sizeof(std::uint64_t) <= data.size(); i += sizeof(std::uint64_t)) {
+        std::uint64_t word;
+        std::memcpy(&word, data.data() + i, sizeof(word));
+        hash = (hash ^ word) * PRIME;
+    }
+    for (; i < data.size(); ++i) {
+        hash = (hash ^ static_cast<unsigned char>(data[i])) * PRIME;
+    }
+    return hash;
+}
+
+std::uint64_t Align(std::uint64_t offset) {
+    return (offset + 7) & ~std::uint64_t(7);
+}
+
+template <typename Record>
+void Append(std::string& section, const Record& record) {
+    section.append(reinterpret_cast<const char*>(&record), sizeof(Record));
+}
+
+template <typename Record>
+std::uint32_t CountOf(const std::string& section) {
+    return static_cast<std::uint32_t>(section.size() / sizeof(Record));
+}
+
+template <typename Record>
+Record Read(std::string_view section, std::size_t index) {
+    Record record;
+    std::memcpy(&record, section.data() + index * sizeof(Record), sizeof(Record));
+    return record;
+}
+
+// Записи [begin, begin + count) лежат в секции
+template <typename Record>
+bool IsInSection(std::string_view section, std::uint64_t begin, std::uint64_t count) {
+    const std::uint64_t size = section.size() / sizeof(Record);
+    return begin <= size && count <= size - begin;
+}
+
+Position ToPosition(PositionRecord record) {
+    return { record.row, record.col };
+}
+
+[[noreturn]] void ThrowCorrupted(const char* what) {
+    throw SnapshotException("snapshot is corrupted: "s + what);
+}
+
+// Объединение прямоугольников ссылок формы, std::nullopt - ссылок нет
+std::optional<CellRange> GetReferenceBounds(const FormulaCache::Template& formula) {
+    std::optional<CellRange> bounds;
+    auto add = [&bounds](const CellRange& range) {
+        if (!bounds) {
+            bounds = range;
+            return;
+        }
+        bounds->from = { std::min(bounds->from.row, range.from.row), std::min(bounds->from.col, range.from.col) };
+        bounds->to = { std::max(bounds->to.row, range.to.row), std::max(bounds->to.col, range.to.col) };
+    };
+    for (Position pos : formula.GetProgram().GetCells()) {
+        add({ pos, pos });
+    }
+    for (const CellRange& range : formula.GetRanges()) {
+        add(range);
+    }
+    return bounds;
+}
+}  // namespace
+
+void SnapshotWriter::AddText(Position pos, std::string_view text, std::uint32_t dependent_count) {
+    CellRecord record{};
+    record.row = pos.row;
+    record.col = pos.col;
+    record.dependent_count = dependent_count;
+    record.template_index = NO_TEMPLATE;
+    record.value_kind = VALUE_NONE;
+    record.text_offset = AddString(text);
+    record.text_size = static_cast<std::uint32_t>(text.size());
+    Append(sections_[std::size_t(SnapshotSection::Cells)], record);
+}
+
+void SnapshotWriter::AddFormula(Position pos, const std::shared_ptr<const FormulaCache::Template>& formula,
+                                const std::optional<FormulaInterface::Value>& value, std::uint32_t dependent_count) {
+    CellRecord record{};
+    record.row = pos.row;
+    record.col = pos.col;
+    record.dependent_count = dependent_count;
+    record.template_index = AddTemplate(formula);
+    record.value_kind = VALUE_NONE;
+    if (value.has_value()) {
+        if (const double* number = std::get_if<double>(&*value)) {
+            record.value_kind = VALUE_NUMBER;
+            record.number = *number;
+        }
+        else {
+            record.value_kind = VALUE_ERROR;
+            record.error = static_cast<std::uint32_t>(std::get<FormulaError>(*value).GetCategory());
+        }
+    }
+    Append(sections_[std::size_t(SnapshotSection::Cells)], record);
+}
+
+std::uint32_t SnapshotWriter::AddTemplate(const std::shared_ptr<const FormulaCache::Template>& formula) {
+    const auto [it, is_new] = template_indices_.emplace(formula.get(), static_cast<std::uint32_t>(templates_.size()));
+    if (!is_new) {
+        return it->second;
+    }
+    templates_.push_back(formula);
+
+    std::string& code = sections_[std::size_t(SnapshotSection::Code)];
+    std::string& constants = sections_[std::size_t(SnapshotSection::Constants)];
+    std::string& cells = sections_[std::size_t(SnapshotSection::CellRefs)];
+    std::string& calls = sections_[std::size_t(SnapshotSection::Calls)];
+    std::string& ranges = sections_[std::size_t(SnapshotSection::Ranges)];
+    const FormulaProgram& program = formula->GetProgram();
+
+    TemplateRecord record{};
+    record.expression_offset = AddString(formula->GetExpression());
+    record.expression_size = static_cast<std::uint32_t>(formula->GetExpression().size());
+    record.anchor_row = formula->GetAnchor().row;
+    record.anchor_col = formula->GetAnchor().col;
+    record.code_begin = CountOf<InstructionRecord>(code);
+    record.code_count = static_cast<std::uint32_t>(program.GetCode().size());
+    record.constant_begin = CountOf<double>(constants);
+    record.constant_count = static_cast<std::uint32_t>(program.GetConstants().size());
+    record.cell_begin = CountOf<PositionRecord>(cells);
+    record.cell_count = static_cast<std::uint32_t>(program.GetCells().size());
+    record.call_begin = CountOf<CallRecord>(calls);
+    record.call_count = static_cast<std::uint32_t>(program.GetCalls().size());
+    record.range_begin = CountOf<RangeRecord>(ranges);
+    record.range_count = static_cast<std::uint32_t>(program.GetRanges().size());
+    Append(sections_[std::size_t(SnapshotSection::Templates)], record);
+
+    for (const FormulaProgram::Instruction& instruction : program.GetCode()) {
+        Append(code, InstructionRecord{ static_cast<std::uint32_t>(instruction.op), instruction.operand });
+    }
+    for (double constant : program.GetConstants()) {
+        Append(constants, constant);
+    }
+    for (Position pos : program.GetCells()) {
+        Append(cells, PositionRecord{ pos.row, pos.col });
+    }
+    for (const FormulaProgram::Call& call : program.GetCalls()) {
+        Append(calls, CallRecord{ static_cast<std::uint32_t>(call.function), call.value_count, call.range_begin,
+                                  call.range_count });
+    }
+    for (const CellRange& range : program.GetRanges()) {
+        Append(ranges, RangeRecord{ { range.from.row, range.from.col }, { range.to.row, range.to.col } });
+    }
+    return it->second;
+}
+
+std::uint64_t SnapshotWriter::AddString(std::string_view text) {
+    std::string& strings = sections_[std::size_t(SnapshotSection::Strings)];
+    const std::uint64_t offset = strings.size();
+    strings.append(text);
+    return offset;
+}
+
+void SnapshotWriter::Save(const std::string& path) const {
+    Header header{};
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.byte_order = BYTE_ORDER_MARK;
+    std::uint64_t offset = sizeof(Header);
+    for (std::size_t i = 0; i < SNAPSHOT_SECTION_COUNT; ++i) {
+        offset = Align(offset);
+        header.sections[i] = { offset, sections_[i].size(), Checksum(sections_[i]) };
+        offset += sections_[i].size();
+    }
+    header.checksum = Checksum({ reinterpret_cast<const char*>(&header), sizeof(header) });
+
+    // снимок виден под именем path только целиком
+    const std::string temp_path = path + ".tmp";
+    {
+        std::ofstream output(temp_path, std::ios::binary | std::ios::trunc);
+        output.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        std::uint64_t written = sizeof(header);
+        for (std::size_t i = 0; i < SNAPSHOT_SECTION_COUNT; ++i) {
+            constexpr char PADDING[8] = {};
+            output.write(PADDING, static_cast<std::streamsize>(header.sections[i].offset - written));
+            output.write(sections_[i].data(), static_cast<std::streamsize>(sections_[i].size()));
+            written = header.sections[i].offset + sections_[i].size();
+        }
+        output.flush();
+        if (!output) {
+            std::error_code ignored;
+            std::filesystem::remove(temp_path, ignored);
+            throw SnapshotException("cannot write snapshot " + temp_path);
+        }
+    }
+    std::error_code error;
+    std::filesystem::rename(temp_path, path, error);
+    if (error) {
+        std::error_code ignored;
+        std::filesystem::remove(temp_path, ignored);
+        throw SnapshotException("cannot write snapshot " + path + ": " + error.message());
+    }
+}
+
+// Файл, отображенный в память только для чтения. Где mmap нет, файл читается
+// целиком.
+class SnapshotReader::MappedFile {
+public:
+    explicit MappedFile(const std::string& path) {
+#ifdef _WIN32
+        std::ifstream input(path, std::ios::binary);
+        if (!input) {
+            throw SnapshotException("cannot open snapshot " + path);
+        }
+        buffer_.assign(std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>());
+        data_ = buffer_.data();
+        size_ = buffer_.size();
+#else
+        const int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw SnapshotException("cannot open snapshot " + path);
+        }
+        struct stat info;
+        if (::fstat(fd, &info) != 0) {
+            ::close(fd);
+            throw SnapshotException("cannot open snapshot " + path);
+        }
+        size_ = static_cast<std::size_t>(info.st_size);
+        if (size_ > 0) {
+            void* data = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data == MAP_FAILED) {
+                ::close(fd);
+                throw SnapshotException("cannot map snapshot " + path);
+            }
+            data_ = static_cast<const char*>(data);
+        }
+        // отображение не зависит от дескриптора
+        ::close(fd);
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() {
+#ifndef _WIN32
+        if (data_ != nullptr) {
+            ::munmap(const_cast<char*>(data_), size_);
+        }
+#endif
+    }
+
+    std::string_view GetData() const {
+        return { data_, size_ };
+    }
+
+private:
+    const char* data_ = nullptr;
+    std::size_t size_ = 0;
+#ifdef _WIN32
+    std::string buffer_;
+#endif
+};
+
+SnapshotReader::SnapshotReader(const std::string& path)
+    : file_(std::make_unique<MappedFile>(path)) {
+    ReadHeader();
+    ReadTemplates();
+    CheckCells();
+}
+
+SnapshotReader::~SnapshotReader() = default;
+
+void SnapshotReader::InternTemplates(FormulaCache& cache) {
+    for (auto& formula : templates_) {
+        formula = cache.Intern(std::move(formula));
+    }
+}
+
+std::size_t SnapshotReader::GetCellCount() const {
+    return sections_[std::size_t(SnapshotSection::Cells)].size() / sizeof(CellRecord);
+}
+
+SnapshotCell SnapshotReader::GetCell(std::size_t index) const {
+    const auto record = Read<CellRecord>(sections_[std::size_t(SnapshotSection::Cells)], index);
+    SnapshotCell cell;
+    cell.pos = { record.row, record.col };
+    cell.dependent_count = record.dependent_count;
+    if (record.template_index == NO_TEMPLATE) {
+        cell.text = GetString(record.text_offset, record.text_size);
+        return cell;
+    }
+    cell.formula = templates_[record.template_index];
+    if (record.value_kind == VALUE_NUMBER) {
+        cell.value = record.number;
+    }
+    else if (record.value_kind == VALUE_ERROR) {
+        cell.value = FormulaError(static_cast<FormulaError::Category>(record.error));
+    }
+    return cell;
+}
+
+void SnapshotReader::ReadHeader() {
+    const std::string_view data = file_->GetData();
+    if (data.size() < sizeof(Header)) {
+        ThrowCorrupted("file is too short");
+    }
+    auto header = Read<Header>(data, 0);
+    if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0) {
+        throw SnapshotException("not a sheet snapshot");
+    }
+    if (header.byte_order != BYTE_ORDER_MARK) {
+        throw SnapshotException("snapshot has a different byte order");
+    }
+    if (header.version != VERSION) {
+        throw SnapshotException("unsupported snapshot version " + std::to_string(header.version));
+    }
+    const std::uint64_t checksum = header.checksum;
+    header.checksum = 0;
+    if (Checksum({ reinterpret_cast<const char*>(&header), sizeof(header) }) != checksum) {
+        ThrowCorrupted("header checksum mismatch");
+    }
+
+    // секции идут подряд с нулевым выравниванием, поэтому любой байт файла
+    // проверяется заголовком, суммой секции или выравниванием
+    std::uint64_t end = sizeof(Header);
+    for (std::size_t i = 0; i < SNAPSHOT_SECTION_COUNT; ++i) {
+        const SectionEntry& entry = header.sections[i];
+        if (entry.offset != Align(end) || entry.offset > data.size() || entry.size > data.size() - entry.offset
+            || entry.size % RECORD_SIZES[i] != 0) {
+            ThrowCorrupted("invalid section bounds");
+        }
+        for (std::uint64_t j = end; j < entry.offset; ++j) {
+            if (data[j] != 0) {
+                ThrowCorrupted("invalid section padding");
+            }
+        }
+        sections_[i] = data.substr(entry.offset, entry.size);
+        if (Checksum(sections_[i]) != entry.checksum) {
+            ThrowCorrupted("section checksum mismatch");
+        }
+        end = entry.offset + entry.size;
+    }
+    if (end != data.size()) {
+        ThrowCorrupted("trailing data");
+    }
+}
+
+void SnapshotReader::ReadTemplates() {
+    const std::string_view records = sections_[std::size_t(SnapshotSection::Templates)];
+    const std::string_view code = sections_[std::size_t(SnapshotSection::Code)];
+    const std::string_view constants = sections_[std::size_t(SnapshotSection::Constants)];
+    const std::string_view cells = sections_[std::size_t(SnapshotSection::CellRefs)];
+    const std::string_view calls = sections_[std::size_t(SnapshotSection::Calls)];
+    const std::string_view ranges = sections_[std::size_t(SnapshotSection::Ranges)];
+
+    const std::size_t count = records.size() / sizeof(TemplateRecord);
+    templates_.reserve(count);
+    std::vector<Position> program_cells;
+    std::vector<CellRange> call_ranges;
+    for (std::size_t i = 0; i < count; ++i) {
+        const auto record = Read<TemplateRecord>(records, i);
+        if (!IsInSection<InstructionRecord>(code, record.code_begin, record.code_count)
+            || !IsInSection<double>(constants, record.constant_begin, record.constant_count)
+            || !IsInSection<PositionRecord>(cells, record.cell_begin, record.cell_count)
+            || !IsInSection<CallRecord>(calls, record.call_begin, record.call_count)
+            || !IsInSection<RangeRecord>(ranges, record.range_begin, record.range_count)) {
+            ThrowCorrupted("formula is out of its sections");
+        }
+
+        // слоты ячеек программы - упорядоченные позиции без повторов
+        program_cells.clear();
+        for (std::uint32_t j = 0; j < record.cell_count; ++j) {
+            const Position pos = ToPosition(Read<PositionRecord>(cells, record.cell_begin + j));
+            if (!pos.IsValid() || (!program_cells.empty() && !(program_cells.back() < pos))) {
+                ThrowCorrupted("invalid formula cells");
+            }
+            program_cells.push_back(pos);
+        }
+
+        // программа собирается заново теми же шагами, что и при компиляции,
+        // с проверкой каждого операнда и глубины стека
+        FormulaProgram program(program_cells);
+        std::uint32_t depth = 0;
+        for (std::uint32_t j = 0; j < record.code_count; ++j) {
+            const auto instruction = Read<InstructionRecord>(code, record.code_begin + j);
+            const auto op = static_cast<FormulaProgram::OpCode>(instruction.op);
+            switch (op) {
+            case FormulaProgram::OpCode::PushNumber:
+                if (instruction.operand >= record.constant_count) {
+                    ThrowCorrupted("invalid constant");
+                }
+                program.PushNumber(Read<double>(constants, record.constant_begin + instruction.operand));
+                ++depth;
+                break;
+            case FormulaProgram::OpCode::PushCell:
+                if (instruction.operand >= record.cell_count) {
+                    ThrowCorrupted("invalid cell slot");
+                }
+                program.PushCell(program_cells[instruction.operand]);
+                ++depth;
+                break;
+            case FormulaProgram::OpCode::Negate:
+                if (depth < 1) {
+                    ThrowCorrupted("stack underflow");
+                }
+                program.PushOperation(op);
+                break;
+            case FormulaProgram::OpCode::Add:
+            case FormulaProgram::OpCode::Subtract:
+            case FormulaProgram::OpCode::Multiply:
+            case FormulaProgram::OpCode::Divide:
+                if (depth < 2) {
+                    ThrowCorrupted("stack underflow");
+                }
+                program.PushOperation(op);
+                --depth;
+                break;
+            case FormulaProgram::OpCode::Call: {
+                if (instruction.operand >= record.call_count) {
+                    ThrowCorrupted("invalid call");
+                }
+                const auto call = Read<CallRecord>(calls, record.call_begin + instruction.operand);
+                // Count - последняя из функций
+                if (call.function > static_cast<std::uint32_t>(FormulaProgram::Function::Count)
+                    || call.value_count > depth || call.range_begin > record.range_count
+                    || call.range_count > record.range_count - call.range_begin) {
+                    ThrowCorrupted("invalid call");
+                }
+                call_ranges.clear();
+                for (std::uint32_t k = 0; k < call.range_count; ++k) {
+                    const auto range = Read<RangeRecord>(ranges, record.range_begin + call.range_begin + k);
+                    call_ranges.push_back({ ToPosition(range.from), ToPosition(range.to) });
+                    if (!call_ranges.back().IsValid()) {
+                        ThrowCorrupted("invalid range");
+                    }
+                }
+                program.PushCall(static_cast<FormulaProgram::Function>(call.function), call.value_count, call_ranges);
+                depth = depth - call.value_count + 1;
+                break;
+            }
+            default:
+                ThrowCorrupted("invalid instruction");
+            }
+        }
+        if (depth != 1) {
+            ThrowCorrupted("formula leaves an invalid stack");
+        }
+
+        const Position anchor{ record.anchor_row, record.anchor_col };
+        if (!anchor.IsValid()) {
+            ThrowCorrupted("invalid formula anchor");
+        }
+        templates_.push_back(std::make_shared<const FormulaCache::Template>(
+            std::string(GetString(record.expression_offset, record.expression_size)), anchor, std::move(program)));
+    }
+}
+
+void SnapshotReader::CheckCells() const {
+    std::vector<std::optional<CellRange>> bounds;
+    bounds.reserve(templates_.size());
+    for (const auto& formula : templates_) {
+        bounds.push_back(GetReferenceBounds(*formula));
+    }
+
+    const std::string_view records = sections_[std::size_t(SnapshotSection::Cells)];
+    std::optional<Position> previous;
+    for (std::size_t i = 0; i < GetCellCount(); ++i) {
+        const auto record = Read<CellRecord>(records, i);
+        const Position pos{ record.row, record.col };
+        if (!pos.IsValid() || (previous && !(*previous < pos))) {
+            ThrowCorrupted("invalid cell position");
+        }
+        previous = pos;
+        // число задает только размер выделяемого списка обратных ссылок
+        if (record.dependent_count > GetCellCount()) {
+            ThrowCorrupted("invalid dependent count");
+        }
+
+        // текст нулевой длины - пустая ячейка
+        if (record.template_index == NO_TEMPLATE) {
+            GetString(record.text_offset, record.text_size);
+            continue;
+        }
+        if (record.template_index >= templates_.size()) {
+            ThrowCorrupted("invalid formula index");
+        }
+        if (record.value_kind > VALUE_ERROR
+            || (record.value_kind == VALUE_ERROR
+                && record.error > static_cast<std::uint32_t>(FormulaError::Category::Arithmetic))) {
+            ThrowCorrupted("invalid cell value");
+        }
+        // сдвинутые ссылки формулы остаются на листе
+        if (const std::optional<CellRange>& box = bounds[record.template_index]) {
+            const Position shift = templates_[record.template_index]->GetShift(pos);
+            const CellRange shifted{ { box->from.row + shift.row, box->from.col + shift.col },
+                                     { box->to.row + shift.row, box->to.col + shift.col } };
+            if (!shifted.from.IsValid() || !shifted.to.IsValid()) {
+                ThrowCorrupted("formula refers outside the sheet");
+            }
+        }
+    }
+}
+
+std::string_view SnapshotReader::GetString(std::uint64_t offset, std::uint32_t size) const {
+    const std::string_view strings = sections_[std::size_t(SnapshotSection::Strings)];
+    if (!IsInSection<char>(strings, offset, size)) {
+        ThrowCorrupted("string is out of its section");
+    }
+    return strings.substr(offset, size);
+}
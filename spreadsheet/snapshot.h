@@ -0,0 +1,100 @@
+#pragma once
+
+#include "common.h"
+#include "formula.h"
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Формат снимка листа (версия 2). Числа хранятся в порядке байт машины,
+// записавшей снимок, маркер порядка проверяется при загрузке.
+//   Заголовок: сигнатура, версия, маркер порядка байт, таблица секций
+//   (смещение, размер, контрольная сумма) и контрольная сумма самого заголовка.
+//   Секции идут подряд, выравнены на 8 байт нулями и состоят из записей
+//   фиксированного размера:
+//   строки, формы формул, их программы (инструкции, константы, ячейки, вызовы
+//   функций, диапазоны) и ячейки листа в порядке позиций.
+// Формула ячейки хранится номером формы и вычисленным значением: как и в кэше
+// формул, одна программа на все формулы одного вида, ссылки ячейки получаются
+// сдвигом ссылок формы. Пустая ячейка хранится текстом нулевой длины.
+// Обратные ссылки восстанавливаются по прямым за один проход; ячейка хранит
+// только их число, чтобы список выделялся сразу нужного размера.
+enum class SnapshotSection : std::uint32_t {
+    Strings,
+    Templates,
+    Code,
+    Constants,
+    CellRefs,
+    Calls,
+    Ranges,
+    Cells,
+    Count,
+};
+
+constexpr std::size_t SNAPSHOT_SECTION_COUNT = static_cast<std::size_t>(SnapshotSection::Count);
+
+// Ячейка снимка
+struct SnapshotCell {
+    Position pos;
+    // текст ячейки без формы формулы, указывает в отображенный файл
+    std::string_view text;
+    std::shared_ptr<const FormulaCache::Template> formula;
+    // кэш формулы, std::nullopt - значение не было вычислено
+    std::optional<FormulaInterface::Value> value;
+    // число формул, ссылающихся на ячейку напрямую; не больше числа ячеек
+    std::uint32_t dependent_count = 0;
+};
+
+class SnapshotWriter {
+public:
+    // Ячейки добавляются в порядке возрастания позиций; dependent_count -
+    // число формул, ссылающихся на ячейку напрямую
+    void AddText(Position pos, std::string_view text, std::uint32_t dependent_count = 0);
+    void AddFormula(Position pos, const std::shared_ptr<const FormulaCache::Template>& formula,
+                    const std::optional<FormulaInterface::Value>& value, std::uint32_t dependent_count = 0);
+
+    // Пишет снимок во временный файл рядом с path и заменяет им path
+    void Save(const std::string& path) const;
+
+private:
+    std::array<std::string, SNAPSHOT_SECTION_COUNT> sections_;
+    std::unordered_map<const FormulaCache::Template*, std::uint32_t> template_indices_;
+    // формы живут, пока снимок не записан
+    std::vector<std::shared_ptr<const FormulaCache::Template>> templates_;
+
+    std::uint32_t AddTemplate(const std::shared_ptr<const FormulaCache::Template>& formula);
+    std::uint64_t AddString(std::string_view text);
+};
+
+// Снимок, отображенный в память. Конструктор проверяет заголовок, контрольные
+// суммы и границы всех записей и восстанавливает формы формул без разбора;
+// тексты ячеек читаются прямо из отображения, пока жив SnapshotReader.
+class SnapshotReader {
+public:
+    explicit SnapshotReader(const std::string& path);
+    ~SnapshotReader();
+
+    // Заменяет формы снимка формами кэша листа
+    void InternTemplates(FormulaCache& cache);
+
+    std::size_t GetCellCount() const;
+    SnapshotCell GetCell(std::size_t index) const;
+
+private:
+    class MappedFile;
+
+    std::unique_ptr<MappedFile> file_;
+    std::array<std::string_view, SNAPSHOT_SECTION_COUNT> sections_;
+    std::vector<std::shared_ptr<const FormulaCache::Template>> templates_;
+
+    void ReadHeader();
+    void ReadTemplates();
+    void CheckCells() const;
+    std::string_view GetString(std::uint64_t offset, std::uint32_t size) const;
+};
@@ -1,13 +1,16 @@
 #include "common.h"
 
-#include <cctype>
-#include <sstream>
+#include <charconv>
+#include <cmath>
 #include <algorithm>
+#include <tuple>
 
 const int LETTERS = 26;
-const int MAX_POSITION_LENGTH = 17;
 const int MAX_POS_LETTER_COUNT = 3;
 
+static_assert(Position::MAX_COLS <= 1 << Position::COL_BITS);
+static_assert(Position::MAX_ROWS <= 1 << (32 - Position::COL_BITS));
+
 const Position Position::NONE = {-1, -1};
 
 bool Position::operator==(const Position rhs) const {
@@ -23,49 +26,52 @@ bool Position::IsValid() const {
 }
 
 std::string Position::ToString() const {
+    char buffer[MAX_STRING_LENGTH];
+    return std::string(buffer, ToChars(buffer));
+}
+
+std::size_t Position::ToChars(char* buffer) const {
     if (!IsValid()) {
-        return "";
+        return 0;
     }
 
-    std::string result;
-    result.reserve(MAX_POSITION_LENGTH);
-    int c = col;
-    while (c >= 0) {
-        result.insert(result.begin(), 'A' + c % LETTERS);
-        c = c / LETTERS - 1;
+    char letters[MAX_POS_LETTER_COUNT];
+    std::size_t letter_count = 0;
+    for (int c = col; c >= 0; c = c / LETTERS - 1) {
+        letters[letter_count++] = static_cast<char>('A' + c % LETTERS);
     }
+    std::reverse_copy(letters, letters + letter_count, buffer);
 
-    result += std::to_string(row + 1);
-
-    return result;
+    const auto result = std::to_chars(buffer + letter_count, buffer + MAX_STRING_LENGTH, row + 1);
+    return static_cast<std::size_t>(result.ptr - buffer);
 }
 
 Position Position::FromString(std::string_view str) {
-    auto it = std::find_if(str.begin(), str.end(), [](const char c) {
-        return !(std::isalpha(c) && std::isupper(c));
-    });
-    auto letters = str.substr(0, it - str.begin());
-    auto digits = str.substr(it - str.begin());
-
-    if (letters.empty() || digits.empty()) {
+    std::size_t letter_count = 0;
+    while (letter_count < str.size() && str[letter_count] >= 'A' && str[letter_count] <= 'Z') {
+        ++letter_count;
+    }
+    if (letter_count == 0 || letter_count == str.size()) {
         return Position::NONE;
     }
-    if (letters.size() > MAX_POS_LETTER_COUNT) {
+    if (letter_count > MAX_POS_LETTER_COUNT) {
         return Position::NONE;
     }
 
-    if (!std::isdigit(digits[0])) {
+    const std::string_view digits = str.substr(letter_count);
+    if (digits[0] < '0' || digits[0] > '9') {
         return Position::NONE;
     }
 
-    int row;
-    std::istringstream row_in{std::string{digits}};
-    if (!(row_in >> row) || !row_in.eof()) {
+    int row = 0;
+    const char* end = digits.data() + digits.size();
+    const auto [ptr, ec] = std::from_chars(digits.data(), end, row);
+    if (ec != std::errc() || ptr != end) {
         return Position::NONE;
     }
 
     int col = 0;
-    for (char ch : letters) {
+    for (char ch : str.substr(0, letter_count)) {
         col *= LETTERS;
         col += ch - 'A' + 1;
     }
@@ -75,4 +81,76 @@ Position Position::FromString(std::string_view str) {
 
 bool Size::operator==(Size rhs) const {
     return cols == rhs.cols && rows == rhs.rows;
-}
\ No newline at end of file
+}
+
+bool CellRange::operator==(const CellRange& rhs) const {
+    return from == rhs.from && to == rhs.to;
+}
+
+bool CellRange::operator<(const CellRange& rhs) const {
+    return std::tie(from, to) < std::tie(rhs.from, rhs.to);
+}
+
+bool CellRange::IsValid() const {
+    return from.IsValid() && to.IsValid() && from.row <= to.row && from.col <= to.col;
+}
+
+bool CellRange::Contains(Position pos) const {
+    return pos.row >= from.row && pos.row <= to.row && pos.col >= from.col && pos.col <= to.col;
+}
+
+std::string CellRange::ToString() const {
+    char buffer[MAX_STRING_LENGTH];
+    return std::string(buffer, ToChars(buffer));
+}
+
+std::size_t CellRange::ToChars(char* buffer) const {
+    if (!IsValid()) {
+        return 0;
+    }
+    std::size_t size = from.ToChars(buffer);
+    buffer[size++] = ':';
+    return size + to.ToChars(buffer + size);
+}
+
+CellRange CellRange::FromCorners(Position first, Position second) {
+    return { { std::min(first.row, second.row), std::min(first.col, second.col) },
+             { std::max(first.row, second.row), std::max(first.col, second.col) } };
+}
+
+bool CellInterface::IsEmpty() const {
+    return GetText().empty();
+}
+
+void SheetInterface::ForEachCellInRange(const CellRange& range,
+                                        const std::function<void(const CellInterface&)>& visitor) const {
+    for (int row = range.from.row; row <= range.to.row; ++row) {
+        for (int col = range.from.col; col <= range.to.col; ++col) {
+            const CellInterface* cell = GetCell({ row, col });
+            if (cell != nullptr && !cell->IsEmpty()) {
+                visitor(*cell);
+            }
+        }
+    }
+}
+
+std::optional<double> CellInterface::GetNumber() const {
+    const Value value = GetValue();
+    if (const double* number = std::get_if<double>(&value)) {
+        return *number;
+    }
+    if (const std::string* text = std::get_if<std::string>(&value)) {
+        return text->empty() ? std::optional<double>(0.0) : ParseNumber(*text);
+    }
+    return std::nullopt;
+}
+
+std::optional<double> CellInterface::ParseNumber(std::string_view text) {
+    double result = 0;
+    const char* end = text.data() + text.size();
+    const auto [ptr, ec] = std::from_chars(text.data(), end, result);
+    if (ec != std::errc() || ptr != end || !std::isfinite(result)) {
+        return std::nullopt;
+    }
+    return result;
+}
@@ -0,0 +1,127 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(std::size_t thread_count) {
+    thread_count = std::max<std::size_t>(thread_count, 1);
+    for (std::size_t i = 0; i < thread_count; ++i) {
+        queues_.push_back(std::make_unique<Queue>());
+    }
+    for (std::size_t i = 1; i < thread_count; ++i) {
+        workers_.emplace_back([this, i] {
+            WorkerLoop(i);
+        });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard lock(mutex_);
+        stop_ = true;
+    }
+    wake_.notify_all();
+    for (std::thread& worker : workers_) {
+        worker.join();
+    }
+}
+
+void ThreadPool::Run(std::size_t count, Invoker invoker, void* context) {
+    if (count == 0) {
+        return;
+    }
+    {
+        std::lock_guard lock(mutex_);
+        invoker_ = invoker;
+        context_ = context;
+        error_ = nullptr;
+        remaining_ = count;
+    }
+
+    const std::size_t thread_count = queues_.size();
+    const std::size_t grain = std::max<std::size_t>(1, count / (thread_count * CHUNKS_PER_THREAD));
+    std::size_t queue = 0;
+    for (std::size_t begin = 0; begin < count; begin += grain) {
+        std::lock_guard lock(queues_[queue]->mutex);
+        queues_[queue]->ranges.push_back({ begin, std::min(count, begin + grain) });
+        queue = (queue + 1) % thread_count;
+    }
+
+    {
+        std::lock_guard lock(mutex_);
+        ++generation_;
+    }
+    wake_.notify_all();
+
+    RunPending(0);
+
+    std::unique_lock lock(mutex_);
+    done_.wait(lock, [this] {
+        return remaining_ == 0;
+    });
+    if (error_) {
+        std::rethrow_exception(error_);
+    }
+}
+
+void ThreadPool::WorkerLoop(std::size_t index) {
+    std::uint64_t seen_generation = 0;
+    while (true) {
+        {
+            std::unique_lock lock(mutex_);
+            wake_.wait(lock, [this, seen_generation] {
+                return stop_ || generation_ != seen_generation;
+            });
+            if (stop_) {
+                return;
+            }
+            seen_generation = generation_;
+        }
+        RunPending(index);
+    }
+}
+
+void ThreadPool::RunPending(std::size_t index) {
+    Range range;
+    while (TryPop(index, range) || TrySteal(index, range)) {
+        try {
+            for (std::size_t i = range.begin; i < range.end; ++i) {
+                invoker_(context_, i);
+            }
+        }
+        catch (...) {
+            std::lock_guard lock(mutex_);
+            if (!error_) {
+                error_ = std::current_exception();
+            }
+        }
+        const std::size_t size = range.end - range.begin;
+        if (remaining_.fetch_sub(size) == size) {
+            std::lock_guard lock(mutex_);
+            done_.notify_all();
+        }
+    }
+}
+
+bool ThreadPool::TryPop(std::size_t index, Range& range) {
+    Queue& queue = *queues_[index];
+    std::lock_guard lock(queue.mutex);
+    if (queue.ranges.empty()) {
+        return false;
+    }
+    range = queue.ranges.back();
+    queue.ranges.pop_back();
+    return true;
+}
+
+bool ThreadPool::TrySteal(std::size_t index, Range& range) {
+    for (std::size_t i = 1; i < queues_.size(); ++i) {
+        Queue& victim = *queues_[(index + i) % queues_.size()];
+        std::lock_guard lock(victim.mutex);
+        if (!victim.ranges.empty()) {
+            range = victim.ranges.front();
+            victim.ranges.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Пул потоков с перехватом работы (work stealing). Каждый поток берет диапазоны
+// индексов из конца своей очереди, а опустошив ее, забирает их из начала
+// очередей других потоков. Вызывающий поток участвует в работе, поэтому пул
+// на N потоков создает N - 1 рабочих потоков. ParallelFor не реентерабелен.
+class ThreadPool {
+public:
+    explicit ThreadPool(std::size_t thread_count);
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+    ~ThreadPool();
+
+    std::size_t GetThreadCount() const {
+        return queues_.size();
+    }
+
+    // Вызывает body(i) для всех i из [0, count) и дожидается завершения.
+    // Первое исключение из body пробрасывается в вызывающий поток.
+    template <typename Body>
+    void ParallelFor(std::size_t count, Body& body) {
+        Run(count, [](void* context, std::size_t index) {
+            (*static_cast<Body*>(context))(index);
+        }, &body);
+    }
+
+private:
+    using Invoker = void (*)(void*, std::size_t);
+
+    struct Range {
+        std::size_t begin;
+        std::size_t end;
+    };
+
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Range> ranges;
+    };
+
+    static constexpr std::size_t CHUNKS_PER_THREAD = 8;
+
+    std::vector<std::unique_ptr<Queue>> queues_;  // очередь 0 - вызывающего потока
+    std::vector<std::thread> workers_;
+
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable done_;
+    std::uint64_t generation_ = 0;
+    bool stop_ = false;
+    std::exception_ptr error_;
+
+    Invoker invoker_ = nullptr;
+    void* context_ = nullptr;
+    std::atomic<std::size_t> remaining_{ 0 };
+
+    void Run(std::size_t count, Invoker invoker, void* context);
+    void WorkerLoop(std::size_t index);
+    void RunPending(std::size_t index);
+    bool TryPop(std::size_t index, Range& range);
+    bool TrySteal(std::size_t index, Range& range);
+};
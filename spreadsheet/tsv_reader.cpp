@@ -0,0 +1,61 @@
+#include "tsv_reader.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <istream>
+#include <system_error>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+TsvReader::TsvReader(std::istream& input, std::size_t chunk_size)
+    : input_(&input)
+    , buffer_(chunk_size) {
+}
+
+TsvReader::TsvReader(int fd, std::size_t chunk_size)
+    : fd_(fd)
+    , buffer_(chunk_size) {
+}
+
+bool TsvReader::Fill() {
+    if (begin_ > 0) {
+        std::memmove(buffer_.data(), buffer_.data() + begin_, end_ - begin_);
+        end_ -= begin_;
+        begin_ = 0;
+    }
+    // в буфере одна незаконченная строка длиннее буфера
+    if (end_ == buffer_.size()) {
+        buffer_.resize(2 * buffer_.size());
+    }
+
+    char* data = buffer_.data() + end_;
+    const std::size_t capacity = buffer_.size() - end_;
+    std::size_t read = 0;
+    if (input_ != nullptr) {
+        input_->read(data, static_cast<std::streamsize>(capacity));
+        read = static_cast<std::size_t>(input_->gcount());
+    }
+    else {
+        while (true) {
+#ifdef _WIN32
+            const int result = _read(fd_, data, static_cast<unsigned>(std::min<std::size_t>(capacity, 1u << 30)));
+#else
+            const ssize_t result = ::read(fd_, data, capacity);
+#endif
+            if (result < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw std::system_error(errno, std::generic_category(), "read");
+            }
+            read = static_cast<std::size_t>(result);
+            break;
+        }
+    }
+    end_ += read;
+    return read > 0;
+}
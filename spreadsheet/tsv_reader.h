@@ -0,0 +1,88 @@
+#pragma once
+
+#include "common.h"
+
+#include <cstddef>
+#include <cstring>
+#include <iosfwd>
+#include <string_view>
+#include <vector>
+
+// Потоковое чтение текста листа в формате PrintTexts(): строки разделены '\n'
+// (допускается "\r\n"), ячейки строки - '\t'. Вход читается блоками по
+// chunk_size байт, поля выделяются прямо в буфере чтения без копирования.
+// Буфер растет только под строку длиннее блока, поэтому память ограничена
+// размером блока и самой длинной строкой, а не размером файла.
+class TsvReader {
+public:
+    static constexpr std::size_t CHUNK_SIZE = std::size_t(1) << 16;
+
+    explicit TsvReader(std::istream& input, std::size_t chunk_size = CHUNK_SIZE);
+    // Дескриптор не закрывается; ошибка чтения - std::system_error
+    explicit TsvReader(int fd, std::size_t chunk_size = CHUNK_SIZE);
+    TsvReader(const TsvReader&) = delete;
+    TsvReader& operator=(const TsvReader&) = delete;
+
+    // Вызывает on_field(Position, std::string_view) для каждого непустого поля
+    // до конца входа. Поле указывает в буфер и действительно только до
+    // возврата из on_field.
+    template <typename OnField>
+    void ForEachField(OnField&& on_field);
+
+private:
+    std::istream* input_ = nullptr;
+    int fd_ = -1;
+    std::vector<char> buffer_;
+    // непрочитанная часть буфера
+    std::size_t begin_ = 0;
+    std::size_t end_ = 0;
+
+    // Переносит непрочитанное в начало буфера и дочитывает вход; false - вход
+    // закончился
+    bool Fill();
+
+    template <typename OnField>
+    static void SplitLine(std::string_view line, int row, OnField& on_field);
+};
+
+template <typename OnField>
+void TsvReader::ForEachField(OnField&& on_field) {
+    int row = 0;
+    do {
+        const char* data = buffer_.data();
+        while (begin_ < end_) {
+            const void* newline = std::memchr(data + begin_, '\n', end_ - begin_);
+            if (newline == nullptr) {
+                break;
+            }
+            const std::size_t line_end = static_cast<const char*>(newline) - data;
+            SplitLine({ data + begin_, line_end - begin_ }, row++, on_field);
+            begin_ = line_end + 1;
+        }
+    } while (Fill());
+    // последняя строка без перевода строки
+    if (begin_ < end_) {
+        SplitLine({ buffer_.data() + begin_, end_ - begin_ }, row, on_field);
+        begin_ = end_;
+    }
+}
+
+template <typename OnField>
+void TsvReader::SplitLine(std::string_view line, int row, OnField& on_field) {
+    if (!line.empty() && line.back() == '\r') {
+        line.remove_suffix(1);
+    }
+    int col = 0;
+    while (true) {
+        const void* tab = std::memchr(line.data(), '\t', line.size());
+        const std::size_t field_end = tab == nullptr ? line.size() : static_cast<const char*>(tab) - line.data();
+        if (field_end > 0) {
+            on_field(Position{ row, col }, line.substr(0, field_end));
+        }
+        if (tab == nullptr) {
+            return;
+        }
+        line.remove_prefix(field_end + 1);
+        ++col;
+    }
+}